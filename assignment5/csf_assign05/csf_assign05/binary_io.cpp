@@ -0,0 +1,83 @@
+#include "binary_io.h"
+
+void BinaryIO::put_u8( std::string &out, uint8_t val )
+{
+  out += char(val);
+}
+
+void BinaryIO::put_u32( std::string &out, uint32_t val )
+{
+  for (int i = 0; i < 4; i++) {
+    out += char((val >> (8 * i)) & 0xff);
+  }
+}
+
+void BinaryIO::put_u64( std::string &out, uint64_t val )
+{
+  for (int i = 0; i < 8; i++) {
+    out += char((val >> (8 * i)) & 0xff);
+  }
+}
+
+void BinaryIO::put_string( std::string &out, const std::string &str )
+{
+  put_u32(out, str.size());
+  out += str;
+}
+
+bool BinaryIO::get_u8( const char *&pos, const char *end, uint8_t &val )
+{
+  if (end - pos < 1) {
+    return false;
+  }
+  val = uint8_t(*pos++);
+  return true;
+}
+
+bool BinaryIO::get_u32( const char *&pos, const char *end, uint32_t &val )
+{
+  if (end - pos < 4) {
+    return false;
+  }
+  val = 0;
+  for (int i = 0; i < 4; i++) {
+    val |= uint32_t(uint8_t(pos[i])) << (8 * i);
+  }
+  pos += 4;
+  return true;
+}
+
+bool BinaryIO::get_u64( const char *&pos, const char *end, uint64_t &val )
+{
+  if (end - pos < 8) {
+    return false;
+  }
+  val = 0;
+  for (int i = 0; i < 8; i++) {
+    val |= uint64_t(uint8_t(pos[i])) << (8 * i);
+  }
+  pos += 8;
+  return true;
+}
+
+bool BinaryIO::get_string( const char *&pos, const char *end, std::string &str )
+{
+  const char *p = pos;
+  uint32_t len;
+  if (!get_u32(p, end, len) || uint32_t(end - p) < len) {
+    return false;
+  }
+  str.assign(p, len);
+  pos = p + len;
+  return true;
+}
+
+uint32_t BinaryIO::checksum( const char *data, size_t len, uint32_t seed )
+{
+  uint32_t hash = seed;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= uint8_t(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
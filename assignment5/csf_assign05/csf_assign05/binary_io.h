@@ -0,0 +1,30 @@
+#ifndef BINARY_IO_H
+#define BINARY_IO_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Helpers for the little binary formats used on disk (write-ahead log,
+// snapshots). Integers are stored little-endian, strings as a u32 length
+// followed by the bytes.
+namespace BinaryIO {
+  void put_u8( std::string &out, uint8_t val );
+  void put_u32( std::string &out, uint32_t val );
+  void put_u64( std::string &out, uint64_t val );
+  void put_string( std::string &out, const std::string &str );
+
+  // Readers advance pos, and return false (leaving val alone) if
+  // there aren't enough bytes left before end.
+  bool get_u8( const char *&pos, const char *end, uint8_t &val );
+  bool get_u32( const char *&pos, const char *end, uint32_t &val );
+  bool get_u64( const char *&pos, const char *end, uint64_t &val );
+  bool get_string( const char *&pos, const char *end, std::string &str );
+
+  // FNV-1a hash, used to detect torn or corrupt records; pass the
+  // previous result as seed to checksum data in pieces
+  const uint32_t CHECKSUM_SEED = 2166136261u;
+  uint32_t checksum( const char *data, size_t len, uint32_t seed = CHECKSUM_SEED );
+};
+
+#endif // BINARY_IO_H
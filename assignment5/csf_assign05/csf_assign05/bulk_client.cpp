@@ -0,0 +1,271 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include "message.h"
+#include "exceptions.h"
+#include "client_util.h"
+#include "client_op.h"
+
+// Runs a stream of operations over persistent, pipelined connections.
+//
+// Each input line is one operation:
+//   get <table> <key>          print the value (in input order, on stdout)
+//   set <table> <key> <value>
+//   incr [-t] <table> <key>    add 1 to the value (-t: as a transaction)
+// Blank lines and lines starting with '#' are ignored. See ClientOp
+// for the requests each operation is made of.
+//
+// Operations are dealt round-robin to the connections, so their order
+// is only preserved with a single connection.
+
+namespace {
+
+struct Operation {
+  unsigned line; // input line number, for error messages
+  ClientOp op;
+
+  bool ok;
+  std::string result; // value for a get, error message on failure
+  double latency_ms; // from sending its batch to reading its last reply
+};
+
+struct Connection {
+  std::string hostname, port, username;
+  unsigned batch_size;
+  bool binary; // use the binary framed protocol
+  std::vector<Operation*> ops;
+};
+
+double elapsed_ms( const struct timespec &start, const struct timespec &end )
+{
+  return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+// turn one input line into the requests that carry it out
+bool parse_operation( const std::string &text, ClientOp &op )
+{
+  std::istringstream in(text);
+  std::vector<std::string> words;
+  std::string word;
+  while (in >> word) {
+    words.push_back(word);
+  }
+
+  bool use_transaction = words.size() == 4 && words[0] == "incr" && words[1] == "-t";
+  if (use_transaction) {
+    words.erase(words.begin() + 1);
+  }
+
+  if (words.size() == 3 && words[0] == "get") {
+    op = ClientOp::get(words[1], words[2]);
+  } else if (words.size() == 4 && words[0] == "set") {
+    op = ClientOp::set(words[1], words[2], words[3]);
+  } else if (words.size() == 3 && words[0] == "incr") {
+    op = ClientOp::incr(words[1], words[2], use_transaction);
+  } else {
+    return false;
+  }
+  return op.is_valid();
+}
+
+void fail_operations( Connection *conn, size_t from, const std::string &why )
+{
+  for (size_t i = from; i < conn->ops.size(); i++) {
+    conn->ops[i]->ok = false;
+    conn->ops[i]->result = why;
+  }
+}
+
+void *connection_worker( void *arg )
+{
+  Connection *conn = static_cast<Connection *>( arg );
+  size_t next = 0;
+  try {
+    ClientUtil client;
+    client.connect(conn->hostname, conn->port, conn->binary);
+    if (!ClientUtil::check_reply(client.request(Message(MessageType::LOGIN, {conn->username})))) {
+      fail_operations(conn, 0, "login failed");
+      return nullptr;
+    }
+
+    while (next < conn->ops.size()) {
+      // send a batch of operations in one write, then collect the replies
+      size_t end = std::min(next + conn->batch_size, conn->ops.size());
+      std::vector<Message> batch;
+      for (size_t i = next; i < end; i++) {
+        const std::vector<Message> &requests = conn->ops[i]->op.get_requests();
+        batch.insert(batch.end(), requests.begin(), requests.end());
+      }
+      struct timespec sent, done;
+      clock_gettime(CLOCK_MONOTONIC, &sent);
+      client.send(batch);
+
+      for (; next < end; next++) {
+        Operation *op = conn->ops[next];
+        std::vector<Message> replies(op->op.get_num_requests());
+        for (Message &reply : replies) {
+          if (!client.receive(reply)) {
+            fail_operations(conn, next, "connection closed by server");
+            return nullptr;
+          }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        op->latency_ms = elapsed_ms(sent, done);
+        op->ok = op->op.check(replies, op->result);
+      }
+    }
+
+    client.request(Message(MessageType::BYE));
+  } catch (std::runtime_error &ex) {
+    fail_operations(conn, next, ex.what());
+  }
+  return nullptr;
+}
+
+double percentile( const std::vector<double> &sorted, double p )
+{
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  size_t i = size_t(p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+void usage()
+{
+  std::cerr << "Usage: ./bulk_client [-c <connections>] [-b <batch size>] [-f <file>] [-B] <hostname> <port> <username>\n";
+  std::cerr << "Options:\n";
+  std::cerr << "  -c <connections> number of connections to spread operations over (default 1)\n";
+  std::cerr << "  -b <batch size>  operations pipelined per round trip (default 32)\n";
+  std::cerr << "  -f <file>        read operations from file instead of stdin\n";
+  std::cerr << "  -B               use the binary protocol\n";
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  unsigned num_conns = 1;
+  unsigned batch_size = 32;
+  std::string filename;
+  bool binary = false;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "c:b:f:B")) != -1 ) {
+    try {
+      if ( opt == 'c' ) {
+        num_conns = std::stoul(optarg);
+      } else if ( opt == 'b' ) {
+        batch_size = std::stoul(optarg);
+      } else if ( opt == 'f' ) {
+        filename = optarg;
+      } else if ( opt == 'B' ) {
+        binary = true;
+      } else {
+        usage();
+        return 1;
+      }
+    } catch ( std::exception &ex ) {
+      usage();
+      return 1;
+    }
+  }
+  if ( argc - optind != 3 || num_conns == 0 || batch_size == 0 ) {
+    usage();
+    return 1;
+  }
+
+  // read every operation up front
+  std::ifstream file;
+  if (!filename.empty()) {
+    file.open(filename);
+    if (!file) {
+      std::cerr << "Error: could not open " << filename << "\n";
+      return 1;
+    }
+  }
+  std::istream &in = filename.empty() ? std::cin : file;
+
+  std::vector<Operation> ops;
+  std::string text;
+  unsigned line = 0;
+  bool parse_failed = false;
+  while (std::getline(in, text)) {
+    line++;
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == std::string::npos || text[first] == '#') {
+      continue;
+    }
+    Operation op = Operation();
+    op.line = line;
+    if (!parse_operation(text, op.op)) {
+      std::cerr << "Error: line " << line << ": invalid operation\n";
+      parse_failed = true;
+      continue;
+    }
+    ops.push_back(op);
+  }
+
+  // deal the operations out to the connections and run them
+  std::vector<Connection> conns(num_conns);
+  for (Connection &conn : conns) {
+    conn.hostname = argv[optind];
+    conn.port = argv[optind + 1];
+    conn.username = argv[optind + 2];
+    conn.batch_size = batch_size;
+    conn.binary = binary;
+  }
+  for (size_t i = 0; i < ops.size(); i++) {
+    conns[i % num_conns].ops.push_back(&ops[i]);
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  std::vector<pthread_t> threads(num_conns);
+  for (unsigned i = 0; i < num_conns; i++) {
+    if (pthread_create(&threads[i], nullptr, connection_worker, &conns[i]) != 0) {
+      std::cerr << "Error: could not create connection thread\n";
+      return 1;
+    }
+  }
+  for (pthread_t thread : threads) {
+    pthread_join(thread, nullptr);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  // results in input order, then the summary
+  unsigned num_failed = 0;
+  std::vector<double> latencies;
+  for (const Operation &op : ops) {
+    if (!op.ok) {
+      std::cerr << "Error: line " << op.line << ": " << op.result << "\n";
+      num_failed++;
+      continue;
+    }
+    latencies.push_back(op.latency_ms);
+    if (op.op.has_result()) {
+      std::cout << op.result << "\n";
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  double secs = elapsed_ms(start, end) / 1000.0;
+  std::cerr << "ops=" << ops.size()
+            << " failed=" << num_failed
+            << " connections=" << num_conns
+            << " elapsed_s=" << secs
+            << " ops_per_sec=" << (secs > 0 ? ops.size() / secs : 0.0) << "\n";
+  std::cerr << "latency_ms"
+            << " p50=" << percentile(latencies, 50)
+            << " p90=" << percentile(latencies, 90)
+            << " p99=" << percentile(latencies, 99)
+            << " max=" << (latencies.empty() ? 0.0 : latencies.back()) << "\n";
+
+  return (num_failed > 0 || parse_failed) ? 1 : 0;
+}
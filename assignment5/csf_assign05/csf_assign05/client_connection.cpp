@@ -1,5 +1,7 @@
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
 #include "csapp.h"
 #include "message.h"
 #include "message_serialization.h"
@@ -7,65 +9,300 @@
 #include "exceptions.h"
 #include "client_connection.h"
 #include "value_stack.h"
+#include "write_ahead_log.h"
+
+namespace {
+
+// precomputed encoding of the most common reply
+const char OK_REPLY[] = "OK\n";
+
+}
 
 ClientConnection::ClientConnection( Server *server, int client_fd )
   : m_server( server )
   , m_client_fd( client_fd )
   , login_status(false)
   , mode_status(0)
+  , m_event_loop(false)
+  , m_loop_events(0)
+  , m_parked(false)
+  , m_parked_since_us(0)
+  , m_input_closed(false)
+  , m_closing(false)
+  , m_input_stalled(false)
+  , m_write_blocked(false)
+  , m_held_from(std::string::npos)
+  , m_held_lsn(0)
+  , m_in_call(false)
+  , m_binary(false)
+  , m_protocol_known(false)
+  , m_optimistic(false)
+  , m_last_txn_aborted(false)
+  , m_txn_ts(0)
 {
   rio_readinitb( &m_fdbuf, m_client_fd );
-  m_stack = new ValueStack();
+  m_server->get_metrics().connection_opened();
 }
 
 ClientConnection::~ClientConnection()
 {
+  if (mode_status == 1) {
+    rollback_trans(); // client went away mid-transaction, release its locks
+  }
+  m_server->get_metrics().connection_closed();
   Close(m_client_fd);
 }
 
 void ClientConnection::chat_with_client()
 {
-  try{ // try-catch for unrecoverable exceptions
-    char buffer[MAXLINE];
-    while(true) // keep accepting requests
-    {
-      try{ // try-catch for recoverable exceptions
-        // read message
-        ssize_t input = rio_readlineb(&m_fdbuf, buffer, MAXLINE);
-        if (input == 0) break;
-
-        // decode message
-        std::string client_msg_str(buffer, input); 
-        Message client_msg;
-        MessageSerialization::decode(client_msg_str, client_msg);
-        Message reply_msg = process_handling(client_msg); // process handling
-        respond(reply_msg); // send response
-        if(client_msg.get_message_type() == MessageType::BYE){
-          break; // stop chatting
+  // the first byte says which protocol the client speaks
+  char first;
+  if (rio_readnb(&m_fdbuf, &first, 1) != 1) {
+    return;
+  }
+  m_binary = (unsigned char) first == MessageSerialization::BINARY_MAGIC;
+  if (m_binary) {
+    chat_binary();
+  } else {
+    chat_text(first);
+  }
+  flush_replies();
+}
+
+void ClientConnection::chat_text( char first )
+{
+  char buffer[MAXLINE];
+  // finish reading the first line
+  buffer[0] = first;
+  ssize_t input = 1;
+  if (first != '\n') {
+    ssize_t rest = rio_readlineb(&m_fdbuf, buffer + 1, MAXLINE - 1);
+    input += rest > 0 ? rest : 0;
+  }
+
+  while(true) // keep accepting requests
+  {
+    if (!handle_request(std::string_view(buffer, input))) {
+      break; // stop chatting
+    }
+    // pipelining: keep handling requests the client has already sent,
+    // and only write the replies once we'd have to wait for more
+    if (!has_buffered_request()) {
+      flush_replies();
+    }
+
+    // read message
+    input = rio_readlineb(&m_fdbuf, buffer, MAXLINE);
+    if (input <= 0) break;
+  }
+}
+
+void ClientConnection::chat_binary()
+{
+  char header[MessageSerialization::BINARY_HEADER_LEN];
+  while (rio_readnb(&m_fdbuf, header, sizeof(header)) == sizeof(header)) {
+    uint32_t len;
+    MessageSerialization::binary_frame_len(std::string_view(header, sizeof(header)), len);
+    if (len > Message::MAX_BINARY_LEN) {
+      handle_error("\"Request is too long\"", MessageType::ERROR);
+      break;
+    }
+    m_frame.resize(len);
+    if (rio_readnb(&m_fdbuf, &m_frame[0], len) != ssize_t(len)) {
+      break;
+    }
+    if (!handle_request(m_frame)) {
+      break; // stop chatting
+    }
+    if (!has_buffered_request()) {
+      flush_replies();
+    }
+  }
+}
+
+bool ClientConnection::has_buffered_request()
+{
+  if (m_binary) {
+    uint32_t len;
+    return MessageSerialization::binary_frame_len(std::string_view(m_fdbuf.rio_bufptr, m_fdbuf.rio_cnt), len)
+      && m_fdbuf.rio_cnt - MessageSerialization::BINARY_HEADER_LEN >= len;
+  }
+  return m_fdbuf.rio_cnt > 0 && memchr(m_fdbuf.rio_bufptr, '\n', m_fdbuf.rio_cnt) != nullptr;
+}
+
+void ClientConnection::start_event_loop_mode()
+{
+  m_event_loop = true;
+  int flags = fcntl(m_client_fd, F_GETFL, 0);
+  fcntl(m_client_fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void ClientConnection::handle_readable()
+{
+  char buffer[MAXLINE];
+  // only one read per readiness event so one client can't hog the loop
+  ssize_t input = read(m_client_fd, buffer, sizeof(buffer));
+  if (input < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return; // try again on the next event
+  }
+  if (input <= 0) {
+    m_input_closed = true; // client closed the connection (or read failed)
+  } else {
+    m_inbuf.append(buffer, input);
+  }
+  resume();
+}
+
+void ClientConnection::resume()
+{
+  if (m_held_from != std::string::npos) {
+    try {
+      if (m_server->is_durable(m_held_lsn)) {
+        m_held_from = std::string::npos; // the held replies can go now
+        m_held_lsn = 0;
+      }
+    } catch (CommException &ex) {
+      // as when wait_durable fails in the other modes: the commits can't
+      // be acknowledged, so the client gets an ERROR instead
+      m_outbuf.resize(m_held_from);
+      m_held_from = std::string::npos;
+      handle_error(ex.what(), MessageType::ERROR);
+      m_closing = true;
+    }
+  }
+  m_parked = false; // a parked request is simply tried again
+  do {
+    process_input();
+    flush_replies(); // one write for every reply handled here
+  } while (m_input_stalled && m_outbuf.size() < MAX_OUTBUF);
+}
+
+bool ClientConnection::is_finished() const
+{
+  // a client that stops sending still gets the replies to what it sent
+  if (!m_outbuf.empty()) {
+    return false;
+  }
+  return m_closing || (m_input_closed && !m_parked && !m_input_stalled);
+}
+
+void ClientConnection::process_input()
+{
+  // the first byte says which protocol the client speaks
+  if (!m_protocol_known) {
+    if (m_inbuf.empty()) {
+      return;
+    }
+    m_protocol_known = true;
+    m_binary = (unsigned char) m_inbuf[0] == MessageSerialization::BINARY_MAGIC;
+    if (m_binary) {
+      m_inbuf.erase(0, 1);
+    }
+  }
+
+  // handle every complete request that has arrived so far (unless the
+  // client isn't reading its replies, so they'd only pile up)
+  size_t start = 0;
+  m_input_stalled = false;
+  while (!m_closing) {
+    if (m_outbuf.size() >= MAX_OUTBUF) {
+      m_input_stalled = true;
+      break;
+    }
+    std::string_view request;
+    size_t next;
+    if (m_binary) {
+      uint32_t len;
+      if (!MessageSerialization::binary_frame_len(std::string_view(m_inbuf).substr(start), len)) {
+        break;
+      }
+      if (len > Message::MAX_BINARY_LEN) {
+        handle_error("\"Request is too long\"", MessageType::ERROR);
+        m_closing = true;
+        break;
+      }
+      if (m_inbuf.size() - start - MessageSerialization::BINARY_HEADER_LEN < len) {
+        break; // rest of the frame hasn't arrived yet
+      }
+      request = std::string_view(m_inbuf).substr(start + MessageSerialization::BINARY_HEADER_LEN, len);
+      next = start + MessageSerialization::BINARY_HEADER_LEN + len;
+    } else {
+      size_t newline = m_inbuf.find('\n', start);
+      if (newline == std::string::npos) {
+        // a request line can never be this long, so the client isn't speaking the protocol
+        if (m_inbuf.size() - start > MAXLINE) {
+          handle_error("\"Request is too long\"", MessageType::ERROR);
+          m_closing = true;
         }
-      } catch (OperationException &ex) { // recoverable
-        handle_error(ex.what(), MessageType::FAILED);
-      } catch (FailedTransaction &ex) { // recoverable
-        handle_error(ex.what(), MessageType::FAILED);
-      } catch (...) {
-        throw;
         break;
       }
+      request = std::string_view(m_inbuf).substr(start, newline + 1 - start);
+      next = newline + 1;
+    }
+    if (!handle_request(request)) {
+      m_closing = true;
+    } else if (m_parked) {
+      break; // leave it at the front of m_inbuf for the retry
+    }
+    start = next;
+  }
+  m_inbuf.erase(0, start);
+}
+
+bool ClientConnection::handle_request( std::string_view client_msg_str )
+{
+  // get this thread's block before dispatching, since getting it is also
+  // what sets up the observer that times the request's stripe locks
+  ServerMetrics::ThreadMetrics *metrics = m_server->get_metrics().for_this_thread();
+  uint64_t start = ServerMetrics::now_us();
+  bool keep_going = true;
+  bool failed = true;
+  try{ // try-catch for unrecoverable exceptions
+    try{ // try-catch for recoverable exceptions
+      // decode message
+      if (m_binary) {
+        MessageSerialization::decode_binary(client_msg_str, m_request);
+      } else {
+        MessageSerialization::decode(client_msg_str, m_request);
+      }
+      const Message &reply = process_handling(m_request); // process handling and send response
+      failed = reply.get_message_type() == MessageType::FAILED; // see record_step()
+      respond(reply);
+      if(m_request.get_message_type() == MessageType::BYE){
+        keep_going = false; // stop chatting
+      }
+    } catch (RequestParked &ex) { // tried again later, as if it hadn't arrived yet
+      m_parked = true;
+      return true;
+    } catch (OperationException &ex) { // recoverable
+      handle_error(ex.what(), MessageType::FAILED);
+    } catch (FailedTransaction &ex) { // recoverable
+      handle_error(ex.what(), MessageType::FAILED);
     }
   } catch (InvalidMessage &ex) { //unrecoverable
     handle_error(ex.what(), MessageType::ERROR);
+    keep_going = false;
   } catch (CommException &ex) { // unrecoverable
     handle_error(ex.what(), MessageType::ERROR);
+    keep_going = false;
   } catch (...) {
     std::cerr << "Error: unexpected error.\n";
-    Close(m_client_fd);
+    keep_going = false;
   }
+  m_parked_since_us = 0;
+  // a request that couldn't be decoded is counted as NONE
+  metrics->record_request(m_request.get_message_type(), ServerMetrics::now_us() - start, failed);
+  return keep_going;
 }
 
 // TODO: additional member functions
-Message ClientConnection::process_handling(Message msg)
+const Message &ClientConnection::process_handling(const Message &msg)
 {
   MessageType type = msg.get_message_type();
+  // between DEFPROC and ENDPROC requests are recorded, not carried out
+  if (!m_proc_name.empty() && type != MessageType::ENDPROC && type != MessageType::BYE) {
+    return record_step(msg);
+  }
   //everything but logged in first checks if client is logged in
   if(type == MessageType::LOGIN){
     return login(msg); 
@@ -87,6 +324,31 @@ Message ClientConnection::process_handling(Message msg)
   } else if (type == MessageType::GET){
     check_has_logged_in();
     return get(msg);
+  } else if (type == MessageType::MGET){
+    check_has_logged_in();
+    return mget(msg);
+  } else if (type == MessageType::MSET){
+    check_has_logged_in();
+    return mset(msg);
+  } else if (type == MessageType::INCR || type == MessageType::FADD
+  || type == MessageType::FSUB || type == MessageType::FMUL){
+    check_has_logged_in();
+    return fetch_and_op(msg);
+  } else if (type == MessageType::DEFPROC){
+    check_has_logged_in();
+    return defproc(msg);
+  } else if (type == MessageType::ENDPROC){
+    check_has_logged_in();
+    return endproc();
+  } else if (type == MessageType::CALL){
+    check_has_logged_in();
+    return call(msg);
+  } else if (type == MessageType::STATS){
+    check_has_logged_in();
+    return stats(msg);
+  } else if (type == MessageType::SCAN || type == MessageType::PREFIX){
+    check_has_logged_in();
+    return scan(msg);
   } else if (type == MessageType::ADD || type == MessageType::MUL 
   ||type == MessageType::SUB ||type == MessageType::DIV){
     check_has_logged_in();
@@ -105,7 +367,7 @@ Message ClientConnection::process_handling(Message msg)
   }
 }
 
-Message ClientConnection::login(Message msg)
+const Message &ClientConnection::login(const Message &msg)
 {
   if(login_status){ // already logged in (not the first message)
     throw InvalidMessage("\"LOGIN may only be the first message\"");
@@ -115,159 +377,670 @@ Message ClientConnection::login(Message msg)
   }
 }
 
-Message ClientConnection::create(Message msg)
+const Message &ClientConnection::create(const Message &msg)
 {
-  std::string table_name = msg.get_table();
+  const std::string &table_name = msg.get_table();
   if(m_server->find_table(table_name) != nullptr){ // table already in server
     throw OperationException("\"Can't create a table that already exists.\"");
   }
-  m_server->create_table(table_name);
+  // CREATE <table> [map|hash] picks the table's storage engine
+  StorageEngine engine = StorageEngine::MAP;
+  if(msg.get_num_args() == 2 && !TableStore::parse_engine(msg.get_arg(1), engine)){
+    throw OperationException("\"Unknown storage engine.\"");
+  }
+  wait_durable(m_server->create_table(table_name, engine));
   return reply_ok();
 }
 
-Message ClientConnection::push(Message msg)
+const Message &ClientConnection::push(const Message &msg)
 {
-  std::string value = msg.get_value();
-  m_stack->push(value);
+  m_stack.push_text(msg.get_value());
   return reply_ok();
 }
 
-Message ClientConnection::pop()
+const Message &ClientConnection::pop()
 {
   check_empty_stack("\"Can't pop an empty stack.\""); //can't pop empty stack
    
-  m_stack->pop();
+  m_stack.pop();
   return reply_ok();
 }
 
-Message ClientConnection::top()
+const Message &ClientConnection::top()
 {
   check_empty_stack("\"Can't get top of an empty stack.\"");
   
   //get top value from stack
-  std::string value = m_stack->get_top(); 
-  return reply_data(value);
+  char buf[Value::MAX_INT_TEXT];
+  return reply_data(m_stack.get_top_text(buf));
 }
 
-Message ClientConnection::set(Message msg)
+const Message &ClientConnection::set(const Message &msg)
 {
-  // retrieve the table and lock it
+  // retrieve the table and lock the key's stripe
   Table *table = get_server_table(msg.get_table()); 
-  lock_table(table);
+  const std::string &key = msg.get_key();
+  if (m_optimistic) {
+    set_optimistic(table, key);
+    return reply_ok();
+  }
+  lock_key(table, key);
 
   // make sure the stack is not empty
-  check_empty_stack("\"no value to set since stack is empty.\"");
+  if (m_stack.is_empty()) {
+    unlock_key(table, key); // only unlock for autocommit mode
+    throw OperationException("\"no value to set since stack is empty.\"");
+  }
   // get the top value from the stack and then pop that value
-  std::string val = m_stack->get_top();
-  m_stack->pop();
-  std::string key = msg.get_key();
+  Value val = m_stack.get_top();
+  m_stack.pop();
   table->set(key, val); // set the value in the table
-  unlock_table(table); // releases the lock only in autocommit mode (stays locked for trans)
+  if (mode_status == 1) {
+    return reply_ok(); // stays locked (and uncommitted) until COMMIT
+  }
+  // autocommit: log and commit right away (a later rollback must not undo this)
+  m_server->begin_commit();
+  unsigned long lsn = m_server->log_commit({ WalWrite{ table->get_name(), key, val.to_string() } });
+  table->commit_stripe(table->stripe_of(key));
+  m_server->end_commit();
+  unlock_key(table, key);
+  wait_durable(lsn); // don't say OK until the change is durable
   return reply_ok();
 }
 
-Message ClientConnection::get(Message msg)
+const Message &ClientConnection::get(const Message &msg)
 {
-  // retrieve the table and lock it 
   Table *table = get_server_table(msg.get_table());
-  lock_table(table);
-  std::string key = msg.get_key(); // get the key
+  const std::string &key = msg.get_key(); // get the key
+
+  if (mode_status == 0) {
+    // autocommit: read the last committed version without taking the
+    // stripe lock, so we never wait behind (or fail because of) a transaction
+    Value val;
+    if (!table->get_committed(key, val)) {
+      throw OperationException("\"key doesn't exist in the table.\"");
+    }
+    m_stack.push(val);
+    return reply_ok();
+  }
+
+  if (m_optimistic) {
+    m_stack.push(get_optimistic(table, key));
+    return reply_ok();
+  }
+
+  // transaction: lock the key's stripe so the value can't change
+  // before we commit (and so we see our own uncommitted changes)
+  lock_key(table, key);
   // if the key doesn't exist, throw an error
   if (!table->has_key(key)) {
-    unlock_table(table); // only unlock for autocommit mode
     throw OperationException("\"key doesn't exist in the table.\"");
   }
   // get the value associated with the key and push onto stack
-  std::string val = table->get(key);
-  m_stack->push(val);
-  // unlock only for autocommit mode
-  unlock_table(table);
+  m_stack.push(table->get(key));
+  return reply_ok();
+}
+
+const Message &ClientConnection::mget(const Message &msg)
+{
+  // like a GET per key, with one table lookup, pushing the values in
+  // key order (so the last key's value ends up on top). If any key is
+  // missing nothing is pushed.
+  Table *table = get_server_table(msg.get_table());
+  unsigned num_keys = msg.get_num_args() - 1;
+  m_batch.resize(num_keys);
+
+  if (mode_status == 0) {
+    // autocommit: committed values, without locking (see get()), so the
+    // values are each committed but not necessarily from the same moment
+    for (unsigned i = 0; i < num_keys; i++) {
+      if (!table->get_committed(msg.get_arg(i + 1), m_batch[i])) {
+        throw OperationException("\"key doesn't exist in the table.\"");
+      }
+    }
+  } else if (m_optimistic) {
+    for (unsigned i = 0; i < num_keys; i++) {
+      m_batch[i] = get_optimistic(table, msg.get_arg(i + 1));
+    }
+  } else {
+    // transaction: lock every key's stripe first (keys sharing a stripe
+    // only lock it once), then read
+    for (unsigned i = 0; i < num_keys; i++) {
+      lock_key(table, msg.get_arg(i + 1));
+    }
+    for (unsigned i = 0; i < num_keys; i++) {
+      const std::string &key = msg.get_arg(i + 1);
+      if (!table->has_key(key)) {
+        throw OperationException("\"key doesn't exist in the table.\"");
+      }
+      m_batch[i] = table->get(key);
+    }
+  }
+
+  for (const Value &val : m_batch) {
+    m_stack.push(val);
+  }
+  return reply_ok();
+}
+
+const Message &ClientConnection::mset(const Message &msg)
+{
+  // like a SET per key, popping one value per key: the top of the stack
+  // goes to the last key (so MGET followed by MSET of the same keys
+  // writes back what was read)
+  Table *table = get_server_table(msg.get_table());
+  unsigned num_keys = msg.get_num_args() - 1;
+  if (m_stack.size() < num_keys) {
+    throw OperationException("\"not enough values on the stack to set.\"");
+  }
+
+  // lock first, so a failed lock leaves the stack alone
+  std::set<std::pair<Table*, unsigned>> stripes;
+  if (mode_status == 0) {
+    // autocommit: every stripe the keys fall in, in order so concurrent
+    // batches can't deadlock, and the batch commits as one
+    for (unsigned i = 1; i <= num_keys; i++) {
+      stripes.insert(std::make_pair(table, table->stripe_of(msg.get_arg(i))));
+    }
+    lock_stripes(stripes);
+  } else if (!m_optimistic) {
+    for (unsigned i = 1; i <= num_keys; i++) {
+      lock_key(table, msg.get_arg(i));
+    }
+  }
+
+  m_batch.resize(num_keys);
+  for (unsigned i = num_keys; i > 0; i--) {
+    m_batch[i - 1] = m_stack.get_top();
+    m_stack.pop();
+  }
+
+  if (m_optimistic) {
+    for (unsigned i = 0; i < num_keys; i++) {
+      m_write_set[std::make_pair(table, msg.get_arg(i + 1))] = m_batch[i];
+    }
+    return reply_ok();
+  }
+  for (unsigned i = 0; i < num_keys; i++) {
+    table->set(msg.get_arg(i + 1), m_batch[i]);
+  }
+  if (mode_status == 1) {
+    return reply_ok(); // stays locked (and uncommitted) until COMMIT
+  }
+
+  // autocommit: log the whole batch as one commit
+  std::vector<WalWrite> writes;
+  for (unsigned i = 0; i < num_keys; i++) {
+    writes.push_back(WalWrite{ table->get_name(), msg.get_arg(i + 1), m_batch[i].to_string() });
+  }
+  m_server->begin_commit();
+  unsigned long lsn = m_server->log_commit(writes);
+  for (auto &locked : stripes) {
+    table->commit_stripe(locked.second);
+  }
+  m_server->end_commit();
+  for (auto &locked : stripes) {
+    table->unlock_stripe(locked.second);
+  }
+  wait_durable(lsn);
+  return reply_ok();
+}
+
+const Message &ClientConnection::fetch_and_op(const Message &msg)
+{
+  // read-modify-write of one key in a single request, so a counter
+  // doesn't need a GET/PUSH/ADD/SET transaction held across round trips
+  MessageType type = msg.get_message_type();
+  bool uses_stack = type != MessageType::INCR;
+  char op = type == MessageType::FSUB ? '-' : type == MessageType::FMUL ? '*' : '+';
+
+  Table *table = get_server_table(msg.get_table());
+  const std::string &key = msg.get_key();
+  int64_t operand = 1;
+  if (uses_stack) {
+    check_empty_stack("\"No operand in stack. Cannot calculate.\"");
+    if (!m_stack.get_top_int(operand)) {
+      throw OperationException("\"Two top value aren't numeric\"");
+    }
+  }
+
+  Value current;
+  if (m_optimistic) {
+    current = get_optimistic(table, key);
+  } else {
+    lock_key(table, key); // autocommit: only until the result is committed below
+    if (!table->has_key(key)) {
+      unlock_key(table, key);
+      throw OperationException("\"key doesn't exist in the table.\"");
+    }
+    current = table->get(key);
+  }
+  int64_t current_int;
+  Value result;
+  try {
+    if (!current.to_int(current_int)) {
+      throw OperationException("\"Two top value aren't numeric\"");
+    }
+    result = Value::from_int(Value::arithmetic(op, current_int, operand));
+  } catch (OperationException &ex) {
+    if (!m_optimistic) {
+      unlock_key(table, key);
+    }
+    throw;
+  }
+
+  // nothing can fail from here on, so it's safe to change the stack
+  if (uses_stack) {
+    m_stack.pop();
+    m_stack.push_int(result.get_int());
+  }
+  if (m_optimistic) {
+    m_write_set[std::make_pair(table, key)] = result;
+    return reply_ok();
+  }
+  table->set(key, result);
+  if (mode_status == 1) {
+    return reply_ok(); // stays locked (and uncommitted) until COMMIT
+  }
+  m_server->begin_commit();
+  unsigned long lsn = m_server->log_commit({ WalWrite{ table->get_name(), key, result.to_string() } });
+  table->commit_stripe(table->stripe_of(key));
+  m_server->end_commit();
+  unlock_key(table, key);
+  wait_durable(lsn);
+  return reply_ok();
+}
+
+const Message &ClientConnection::defproc(const Message &msg)
+{
+  m_proc_name = msg.get_arg(0);
+  m_proc_steps.clear();
+  return reply_ok();
+}
+
+const Message &ClientConnection::record_step(const Message &msg)
+{
+  // only requests that work on the stack and tables (no replies to
+  // read back, no transactions, no nested procedures)
+  switch (msg.get_message_type()) {
+  case MessageType::PUSH: case MessageType::POP:
+  case MessageType::GET: case MessageType::SET:
+  case MessageType::MGET: case MessageType::MSET:
+  case MessageType::ADD: case MessageType::SUB:
+  case MessageType::MUL: case MessageType::DIV:
+  case MessageType::INCR: case MessageType::FADD:
+  case MessageType::FSUB: case MessageType::FMUL:
+    break;
+  default:
+    // a mistake in the definition, not in the transaction (if one is
+    // open), so reply FAILED without throwing, which would roll it back
+    return reply_failed("\"Request can't be part of a procedure\"");
+  }
+  if (m_proc_steps.size() >= MAX_PROC_STEPS) {
+    return reply_failed("\"Procedure has too many requests\"");
+  }
+  m_proc_steps.push_back(msg);
+  return reply_ok();
+}
+
+const Message &ClientConnection::endproc()
+{
+  if (m_proc_name.empty()) {
+    throw OperationException("\"No procedure is being defined\"");
+  }
+  std::string name;
+  name.swap(m_proc_name); // recording is over even if the procedure is rejected
+  if (m_proc_steps.empty()) {
+    return reply_failed("\"Procedure has no requests\""); // see record_step()
+  }
+  m_server->define_procedure(name, m_proc_steps);
+  m_proc_steps.clear();
   return reply_ok();
 }
 
-Message ClientConnection::handle_arithmetic(MessageType type)
+const Message &ClientConnection::call(const Message &msg)
+{
+  Procedure proc = m_server->find_procedure(msg.get_arg(0));
+  if (!proc) {
+    throw OperationException("\"Procedure does not exist.\"");
+  }
+  // if a step fails, the stack goes back to how it was before the CALL
+  // (assigned rather than copied into a new stack, so its memory is reused)
+  m_saved_stack = m_stack;
+
+  if (mode_status == 1) {
+    // in a transaction the steps are simply part of it (and a failed
+    // step rolls the whole transaction back, like any failed request)
+    m_in_call = true;
+    try {
+      for (const Message &step : *proc) {
+        process_handling(step);
+      }
+    } catch (...) {
+      m_in_call = false;
+      m_stack = m_saved_stack;
+      throw;
+    }
+    m_in_call = false;
+    return reply_ok();
+  }
+
+  // autocommit: lock every stripe the steps touch up front, in (table,
+  // stripe) order like an optimistic commit so it can't deadlock, then
+  // run the steps as a transaction that already holds all its locks.
+  // Every keyed request has the table first and keys after it.
+  std::set<std::pair<Table*, unsigned>> stripes;
+  for (const Message &step : *proc) {
+    switch (step.get_message_type()) {
+    case MessageType::PUSH: case MessageType::POP:
+    case MessageType::ADD: case MessageType::SUB:
+    case MessageType::MUL: case MessageType::DIV:
+      break;
+    default: {
+      Table *table = get_server_table(step.get_table());
+      for (unsigned i = 1; i < step.get_num_args(); i++) {
+        stripes.insert(std::make_pair(table, table->stripe_of(step.get_arg(i))));
+      }
+    }
+    }
+  }
+  lock_stripes(stripes);
+  locked_stripes = stripes;
+  mode_status = 1;
+  m_in_call = true;
+  try {
+    for (const Message &step : *proc) {
+      process_handling(step);
+    }
+  } catch (...) {
+    m_in_call = false;
+    for (auto &locked : locked_stripes) {
+      locked.first->rollback_stripe(locked.second);
+      locked.first->unlock_stripe(locked.second);
+    }
+    locked_stripes.clear();
+    mode_status = 0;
+    m_stack = m_saved_stack;
+    throw;
+  }
+  m_in_call = false;
+  wait_durable(commit_locked_stripes());
+  return reply_ok();
+}
+
+const Message &ClientConnection::stats(const Message &msg)
+{
+  if (msg.get_num_args() == 0) {
+    return reply_data(m_server->stats_summary(','));
+  }
+  MessageType type = MessageSerialization::lookup_command(msg.get_arg(0));
+  if (type == MessageType::NONE) {
+    throw OperationException("\"Unknown command\"");
+  }
+  std::string command_stats = m_server->command_stats(type, ',');
+  if (command_stats.empty()) {
+    throw OperationException("\"Command hasn't been handled yet\"");
+  }
+  return reply_data(command_stats);
+}
+
+const Message &ClientConnection::scan(const Message &msg)
+{
+  // SCAN <table> <limit> [<after>] / PREFIX <table> <prefix> <limit> [<after>]
+  // Streams an ENTRY reply per committed entry, in key order, then OK if
+  // that was all of them, or DATA <last key> (to pass as <after> for the
+  // rest) if it stopped at the limit. Committed data only (even in a
+  // transaction), and no stripe locks, so a big scan never holds anyone up.
+  bool prefix_scan = msg.get_message_type() == MessageType::PREFIX;
+  unsigned limit_index = prefix_scan ? 2 : 1;
+  Table *table = get_server_table(msg.get_table());
+  const std::string &limit_str = msg.get_arg(limit_index);
+  size_t limit = MAX_SCAN_LIMIT;
+  if (limit_str.size() <= 4) { // anything longer is over the cap anyway
+    limit = std::min(limit, size_t(std::stoul(limit_str)));
+  }
+  if (limit == 0) {
+    throw OperationException("\"Limit must be positive\"");
+  }
+
+  m_scan.clear();
+  table->scan_committed(msg.get_num_args() > limit_index + 1 ? msg.get_arg(limit_index + 1) : std::string(),
+                        prefix_scan ? msg.get_arg(1) : std::string(), limit, m_scan);
+  // fail before anything is sent, rather than partway through
+  for (const auto &entry : m_scan) {
+    if (!m_binary && entry.first.size() + entry.second.text_size() + 8 > Message::MAX_ENCODED_LEN) {
+      throw OperationException("\"Value is too long for the text protocol\"");
+    }
+  }
+
+  char buf[Value::MAX_INT_TEXT];
+  for (const auto &entry : m_scan) {
+    m_reply.clear();
+    m_reply.set_message_type(MessageType::ENTRY);
+    m_reply.push_arg(entry.first);
+    m_reply.push_arg(entry.second.text(buf));
+    respond(m_reply);
+  }
+  if (m_scan.size() == limit) {
+    return reply_data(m_scan.back().first);
+  }
+  return reply_ok();
+}
+
+const Message &ClientConnection::handle_arithmetic(MessageType type)
 {
   check_empty_stack("\"No values in stack. Cannot calculate.\""); // check first operator is not empty
-  std::string right_val = m_stack->get_top(); // right operator string
-  m_stack->pop();
+  int64_t right, left; // integer operands (no parsing if they were pushed as results)
+  bool right_is_int = m_stack.get_top_int(right);
+  m_stack.pop();
   check_empty_stack("\"Only one operator. Cannot calculate.\"");// check second operator is not empty
-  std::string left_val = m_stack->get_top(); // left operator string
-  m_stack->pop();
+  bool left_is_int = m_stack.get_top_int(left);
+  m_stack.pop();
 
-  //make sure strings are integers
-  if(!(string_is_digit(right_val) && string_is_digit(left_val))){
+  //make sure values are integers
+  if(!(right_is_int && left_is_int)){
     throw OperationException("\"Two top value aren't numeric\"");
   } 
-  // integer operators
-  unsigned right = std::stoi(right_val); 
-  unsigned left = std::stoi(left_val);
-  std::string value = do_arithmetic(type, left, right); // do specified math
-  m_stack->push(value); // push back onto stack
+  // do specified math (overflow-checked) and push back onto stack
+  m_stack.push_int(Value::arithmetic(arithmetic_op(type), left, right));
 
   return reply_ok();
 }
 
-Message ClientConnection::begin()
+const Message &ClientConnection::begin()
 {
   if (mode_status == 1) {
     throw OperationException("\"Cannot begin a transaction while already in one.\"");
   }
   mode_status = 1; // switch from autocommit to trans (0 is autocommit, 1 is trans)
+  m_optimistic = m_server->get_transaction_mode() == TransactionMode::OPTIMISTIC;
+  // wait-die: a retry keeps the timestamp of the transaction it retries,
+  // so it gets older until nothing can make it die
+  if (!m_last_txn_aborted || m_txn_ts == 0) {
+    m_txn_ts = m_server->next_txn_timestamp();
+  }
+
+  TransactionStats &stats = m_server->get_txn_stats();
+  stats.begun++;
+  if (m_last_txn_aborted) {
+    stats.retries++;
+    m_last_txn_aborted = false;
+  }
   return reply_ok();
 }
 
-Message ClientConnection::commit()
+const Message &ClientConnection::commit()
 {
   if (mode_status == 0) {
     throw OperationException("\"no transaction has started\"");
   }
-  // we want to commit for all locked tables then unlock them when finished 
-  for (auto &table_name : locked_tables) {
-    Table *t = get_server_table(table_name);
-    t->commit_changes();
-    t->unlock();
+  if (m_optimistic) {
+    return commit_optimistic();
   }
-  // clear the locked tables then exit trans mode
-  locked_tables.clear();
-  mode_status = 0;
+  unsigned long lsn = commit_locked_stripes();
+  m_server->get_txn_stats().committed++;
+  wait_durable(lsn); // group commit: shares an fsync with other commits
   return reply_ok();
 }
 
-Message ClientConnection::bye()
+unsigned long ClientConnection::commit_locked_stripes()
 {
-  login_status = false; // logout
+  // log the changes while we still hold the locks, so the log has
+  // them in the same order as they happened
+  std::vector<WalWrite> writes;
+  std::vector<std::pair<std::string, Value>> stripe_writes;
+  for (auto &locked : locked_stripes) {
+    stripe_writes.clear();
+    locked.first->get_pending_writes(locked.second, stripe_writes);
+    for (auto &write : stripe_writes) {
+      writes.push_back(WalWrite{ locked.first->get_name(), write.first, write.second.to_string() });
+    }
+  }
+  m_server->begin_commit();
+  unsigned long lsn = m_server->log_commit(writes);
+
+  // we want to commit for all locked stripes then unlock them when finished 
+  for (auto &locked : locked_stripes) {
+    locked.first->commit_stripe(locked.second);
+  }
+  m_server->end_commit();
+  for (auto &locked : locked_stripes) {
+    locked.first->unlock_stripe(locked.second);
+  }
+  // clear the locked stripes then exit trans mode
+  locked_stripes.clear();
+  mode_status = 0;
+  return lsn;
+}
+
+const Message &ClientConnection::commit_optimistic()
+{
+  // lock every stripe we read or wrote, in (table, stripe) order, so
+  // concurrent committers can't deadlock; blocking is fine since no one
+  // holds a stripe for longer than a single request or commit (but the
+  // event loop parks instead, see lock_stripes())
+  std::set<std::pair<Table*, unsigned>> stripes;
+  for (auto &read : m_read_set) {
+    stripes.insert(std::make_pair(read.first.first, read.first.first->stripe_of(read.first.second)));
+  }
+  for (auto &write : m_write_set) {
+    stripes.insert(std::make_pair(write.first.first, write.first.first->stripe_of(write.first.second)));
+  }
+  lock_stripes(stripes);
+
+  // validate: everything we read must still be what's committed now.
+  // If the stripe's version hasn't moved, nothing in it changed; if it
+  // has, compare the value itself so unrelated keys don't cause aborts.
+  bool valid = true;
+  for (auto &read : m_read_set) {
+    Table *table = read.first.first;
+    const std::string &key = read.first.second;
+    Value current;
+    unsigned long version;
+    bool found = table->get_committed(key, current, &version);
+    if (version != read.second.version
+        && (found != read.second.found || (found && current != read.second.value))) {
+      valid = false;
+      break;
+    }
+  }
+
+  unsigned long lsn = 0;
+  if (valid) {
+    // install the buffered writes, log them, and commit them
+    std::vector<WalWrite> writes;
+    for (auto &write : m_write_set) {
+      write.first.first->set(write.first.second, write.second);
+      writes.push_back(WalWrite{ write.first.first->get_name(), write.first.second, write.second.to_string() });
+    }
+    m_server->begin_commit();
+    lsn = m_server->log_commit(writes);
+    for (auto &locked : stripes) {
+      locked.first->commit_stripe(locked.second);
+    }
+    m_server->end_commit();
+  }
+  for (auto &locked : stripes) {
+    locked.first->unlock_stripe(locked.second);
+  }
+
+  if (!valid) {
+    m_server->get_txn_stats().validation_conflicts++;
+    throw FailedTransaction("\"transaction conflicts with a concurrent commit\"");
+  }
+
+  m_read_set.clear();
+  m_write_set.clear();
+  m_optimistic = false;
+  mode_status = 0;
+  m_server->get_txn_stats().committed++;
+  wait_durable(lsn);
   return reply_ok();
 }
 
-Message ClientConnection::reply_ok()
+const Value &ClientConnection::get_optimistic(Table *table, const std::string &key)
 {
-  return Message(MessageType::OK); // create ok message
+  std::pair<Table*, std::string> table_key(table, key);
+
+  // read our own buffered write first
+  auto write = m_write_set.find(table_key);
+  if (write != m_write_set.end()) {
+    return write->second;
+  }
+
+  // repeated reads see the same value as the first one
+  auto read = m_read_set.find(table_key);
+  if (read == m_read_set.end()) {
+    OccRead entry;
+    entry.found = table->get_committed(key, entry.value, &entry.version);
+    read = m_read_set.insert(std::make_pair(table_key, entry)).first;
+  }
+  if (!read->second.found) {
+    throw OperationException("\"key doesn't exist in the table.\"");
+  }
+  return read->second.value;
 }
 
-Message ClientConnection::reply_data(std::string value)
+void ClientConnection::set_optimistic(Table *table, const std::string &key)
 {
-  return Message(MessageType::DATA, {value}); //create data message
+  check_empty_stack("\"no value to set since stack is empty.\"");
+  m_write_set[std::make_pair(table, key)] = m_stack.get_top();
+  m_stack.pop();
 }
 
-void ClientConnection::autocommit_lock(Table* table_ptr)
+const Message &ClientConnection::bye()
 {
-  if(table_ptr != nullptr){
-    if(mode_status == 0){ // do only in autocommit mode
-      table_ptr->lock();
-    }
-  } 
+  login_status = false; // logout
+  m_stack.clear(); // nothing can use it now (its memory goes with the connection)
+  return reply_ok();
 }
 
-void ClientConnection::autocommit_unlock(Table* table_ptr)
+const Message &ClientConnection::reply_ok()
 {
-  if(table_ptr != nullptr){
-    if(mode_status == 0){ //do only in autocommit mode
-      table_ptr->unlock();
-    }
+  m_reply.clear(); // create ok message
+  m_reply.set_message_type(MessageType::OK);
+  return m_reply;
+}
+
+const Message &ClientConnection::reply_data(std::string_view value)
+{
+  // values stored by binary clients can be too long for a text DATA line
+  if (!m_binary && value.size() + 6 > Message::MAX_ENCODED_LEN) {
+    throw OperationException("\"Value is too long for the text protocol\"");
   }
+  m_reply.clear(); //create data message
+  m_reply.set_message_type(MessageType::DATA);
+  m_reply.push_arg(value);
+  return m_reply;
+}
+
+const Message &ClientConnection::reply_value(const Value &value)
+{
+  char buf[Value::MAX_INT_TEXT];
+  return reply_data(value.text(buf)); // integers are only turned into text here
 }
 
-Table* ClientConnection::get_server_table(std::string table_name)
+Table* ClientConnection::get_server_table(const std::string &table_name)
 {
   // find table by name
   Table *table = m_server->find_table(table_name);
@@ -278,34 +1051,16 @@ Table* ClientConnection::get_server_table(std::string table_name)
   }
 }
 
-bool ClientConnection::string_is_digit(std::string& str) 
+char ClientConnection::arithmetic_op(MessageType type)
 {
-  // for every char in string
-  for(long unsigned i = 0; i<str.size(); i++ ){
-    if(!isdigit(str[i])){ // false if any string isn't a digit
-      return false;
-    }
-  }
-  return true; // no strings weren't a digit
-}
-
-std::string ClientConnection::do_arithmetic(MessageType type, unsigned left, unsigned right)
-{
-  //do specified math
-  std::string value;
   if(type == MessageType::ADD){
-    value = std::to_string(left + right);
+    return '+';
   } else if(type == MessageType::MUL) {
-    value = std::to_string(left * right);
+    return '*';
   } else if(type == MessageType::SUB){
-    value = std::to_string(left - right);
-  } else {
-    if(right == 0){ // cannot divide by 0
-      throw OperationException("\"Cannot divide by zero.\"");
-    }
-    value = std::to_string(left / right);
+    return '-';
   }
-  return value;
+  return '/';
 }
 
 void ClientConnection::handle_error(const std::string error_msg, MessageType error_type)
@@ -314,33 +1069,106 @@ void ClientConnection::handle_error(const std::string error_msg, MessageType err
     rollback_trans(); // ADDED FOR TRANSACTION
   }
 
-  Message reply_msg;
   if(error_type == MessageType::ERROR){ // unrecoverable
     login_status = false; // added this to end session since its unrecoverable but this could be wrong so I will double check
-    reply_msg = reply_error(error_msg);
+    respond(reply_error(error_msg)); // send message
   } else { // recoverable
-    reply_msg = reply_failed(error_msg);
+    respond(reply_failed(error_msg));
   }
-  respond(reply_msg); // send message
 }
 
-Message ClientConnection::reply_error(const std::string error_msg)
+const Message &ClientConnection::reply_error(const std::string &error_msg)
 {
   login_status = false; //logs out when cannot continue due to error
-  return Message(MessageType::ERROR, {error_msg}); // create error message
+  m_reply.clear(); // create error message
+  m_reply.set_message_type(MessageType::ERROR);
+  m_reply.push_arg(error_msg);
+  return m_reply;
 }
 
-Message ClientConnection::reply_failed(const std::string error_msg)
+const Message &ClientConnection::reply_failed(const std::string &error_msg)
 {
-  return Message(MessageType::FAILED, {error_msg}); // create failed message
+  m_reply.clear(); // create failed message
+  m_reply.set_message_type(MessageType::FAILED);
+  m_reply.push_arg(error_msg);
+  return m_reply;
 }
 
-void ClientConnection::respond(Message reply)
+void ClientConnection::respond(const Message &reply)
 {
-  std::string reply_str;
-  MessageSerialization::encode(reply, reply_str); // encode message to string
+  // encode straight into the output buffer (OK is by far the most
+  // common reply, so it's just copied in)
+  if (m_binary) {
+    MessageSerialization::encode_binary_append(reply, m_outbuf);
+  } else if (reply.get_message_type() == MessageType::OK) {
+    m_outbuf.append(OK_REPLY, sizeof(OK_REPLY) - 1);
+  } else {
+    MessageSerialization::encode_append(reply, m_outbuf);
+  }
 
-  rio_writen(m_client_fd, reply_str.c_str(), reply_str.length()); // write to client
+  // don't let a client that never stops pipelining grow the buffer forever
+  if (m_outbuf.size() >= MAX_OUTBUF) {
+    flush_replies();
+  }
+}
+
+void ClientConnection::flush_replies()
+{
+  if (m_outbuf.empty()) {
+    return;
+  }
+  if (!m_event_loop) {
+    rio_writen(m_client_fd, m_outbuf.data(), m_outbuf.length()); // write to client
+    m_outbuf.clear();
+    return;
+  }
+
+  // event loop: nothing goes while replies are held back (sending the
+  // ones before them on their own would just split the write, as in the
+  // other modes they'd go out together once the commit is durable)
+  if (m_held_from != std::string::npos) {
+    m_write_blocked = false;
+    return;
+  }
+  // write what the socket will take, and leave the rest for when the
+  // loop says it's writable
+  size_t sent = 0;
+  while (sent < m_outbuf.size()) {
+    ssize_t n = write(m_client_fd, m_outbuf.data() + sent, m_outbuf.size() - sent);
+    if (n > 0) {
+      sent += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      // the client has gone away, so nothing more can be sent
+      m_outbuf.clear();
+      m_write_blocked = false;
+      m_closing = true;
+      return;
+    }
+  }
+  m_outbuf.erase(0, sent);
+  m_write_blocked = !m_outbuf.empty();
+}
+
+void ClientConnection::wait_durable(unsigned long lsn)
+{
+  if (!m_event_loop) {
+    m_server->wait_durable(lsn);
+    return;
+  }
+  // the reply to this request is about to be added to m_outbuf, so hold
+  // back everything from here until the loop sees lsn is durable; other
+  // commits made meanwhile (on any connection) share the same fsync
+  if (m_server->is_durable(lsn)) {
+    return;
+  }
+  if (m_held_from == std::string::npos) {
+    m_held_from = m_outbuf.size();
+  }
+  m_held_lsn = std::max(m_held_lsn, lsn);
 }
 
 void ClientConnection::check_has_logged_in()
@@ -353,44 +1181,101 @@ void ClientConnection::check_has_logged_in()
 
 void ClientConnection::check_empty_stack(const std::string error_msg)
 {
-  if(m_stack->is_empty()){
+  if(m_stack.is_empty()){
     throw OperationException(error_msg);
   }
 }
 
 // added for transaction
 void ClientConnection::rollback_trans() {
-  // go thru all the locked tables in this transaction
-  for (auto &tname : locked_tables) {
-    Table *t = get_server_table(tname);
-    t->rollback_changes(); // revert the table's state (prior to transaction)
-    t->unlock(); // release the lock
-  }
-  // clear the locked tables and exit (returns back to autocommit mode)
-  locked_tables.clear();
+  // go thru all the locked stripes in this transaction
+  for (auto &locked : locked_stripes) {
+    locked.first->rollback_stripe(locked.second); // revert the stripe's state (prior to transaction)
+    locked.first->unlock_stripe(locked.second); // release the lock
+  }
+  // clear the locked stripes and buffered reads/writes and exit (returns back to autocommit mode)
+  locked_stripes.clear();
+  m_read_set.clear();
+  m_write_set.clear();
+  m_optimistic = false;
   mode_status = 0;
+  m_last_txn_aborted = true;
+  m_server->get_txn_stats().aborted++;
 }
 
-void ClientConnection::lock_table(Table *table) {
+void ClientConnection::lock_key(Table *table, const std::string &key) {
+  unsigned stripe = table->stripe_of(key);
   if (mode_status == 0) {
-    table->lock(); // autocommit mode so we just lock
+    lock_stripes({ std::make_pair(table, stripe) }); // autocommit mode so we just lock
   } else {
     // transaction mode: if it isn't alr locked, trylock
-    std::string table_name = table->get_name();
-    if (locked_tables.find(table_name) == locked_tables.end()) {
-      // if trylock doesnt work
-      if (!table->trylock()) {
+    std::pair<Table*, unsigned> locked(table, stripe);
+    if (locked_stripes.find(locked) == locked_stripes.end()) {
+      bool got_lock;
+      if (m_server->get_transaction_mode() == TransactionMode::WAIT_DIE && m_event_loop) {
+        // the loop can't wait, so waiting means parking the request (and
+        // trying again) until MAX_LOCK_WAIT_MS is up. Not in a CALL, whose
+        // earlier steps have already been carried out.
+        bool waited;
+        got_lock = table->lock_stripe_wait_die(stripe, m_txn_ts, 0, waited);
+        unsigned long holder = got_lock ? 0 : table->stripe_owner(stripe);
+        if (!got_lock && !m_in_call && (holder == 0 || holder > m_txn_ts)) {
+          uint64_t now = ServerMetrics::now_us();
+          if (m_parked_since_us == 0) {
+            m_parked_since_us = now;
+            m_server->get_txn_stats().lock_waits++;
+          }
+          if (now - m_parked_since_us < MAX_LOCK_WAIT_MS * 1000) {
+            park();
+          }
+        }
+      } else if (m_server->get_transaction_mode() == TransactionMode::WAIT_DIE) {
+        bool waited;
+        got_lock = table->lock_stripe_wait_die(stripe, m_txn_ts, MAX_LOCK_WAIT_MS, waited);
+        if (waited) {
+          m_server->get_txn_stats().lock_waits++;
+        }
+      } else {
+        got_lock = table->trylock_stripe(stripe);
+      }
+      // if we couldn't get the lock
+      if (!got_lock) {
+        m_server->get_txn_stats().lock_conflicts++;
         throw FailedTransaction("\"couldn't get a lock on the table\"");
       }
-      locked_tables.insert(table_name); // success so we log this table as 'locked'
+      locked_stripes.insert(locked); // success so we log this stripe as 'locked'
     }
   }
 }
 
-void ClientConnection::unlock_table(Table *table) {
+void ClientConnection::unlock_key(Table *table, const std::string &key) {
   if (mode_status == 0) {
-    table->unlock(); // unlock if alr in autocommit mode
+    table->unlock_stripe(table->stripe_of(key)); // unlock if alr in autocommit mode
   }
   // transaction mode won't do nothing here so we should just unlock at commit/rollback
 }
 
+void ClientConnection::lock_stripes(const std::set<std::pair<Table*, unsigned>> &stripes) {
+  if (!m_event_loop) {
+    for (auto &locked : stripes) {
+      locked.first->lock_stripe(locked.second);
+    }
+    return;
+  }
+  // event loop mode: whoever holds a stripe may be a transaction whose
+  // COMMIT this very loop has yet to read, so never wait for one. Give
+  // back what we got (in order, so nobody can starve anybody for good)
+  // and park the request until the loop tries it again.
+  for (auto it = stripes.begin(); it != stripes.end(); ++it) {
+    if (!it->first->trylock_stripe(it->second)) {
+      for (auto locked = stripes.begin(); locked != it; ++locked) {
+        locked->first->unlock_stripe(locked->second);
+      }
+      park();
+    }
+  }
+}
+
+void ClientConnection::park() {
+  throw RequestParked();
+}
@@ -2,69 +2,168 @@
 #define CLIENT_CONNECTION_H
 
 #include <set>
+#include <map>
+#include <utility>
+#include <string_view>
+#include <vector>
 #include "message.h"
+#include "value.h"
+#include "value_stack.h"
 #include "csapp.h"
 
 class Server; // forward declaration
 class Table; // forward declaration
-class ValueStack; //forward declare
 
 class ClientConnection {
 private:
   Server *m_server;
   int m_client_fd;
   rio_t m_fdbuf;
-  ValueStack *m_stack; 
-  std::set<std::string> locked_tables;
+  ValueStack m_stack; // its memory is reused for the whole connection
+  ValueStack m_saved_stack; // m_stack before a CALL, restored if a step fails
+  std::set<std::pair<Table*, unsigned>> locked_stripes; // (table, stripe) pairs held by the transaction
   bool login_status;
   int mode_status; // mode = 0 when autocommit and mode = 1 when in transaction
+  std::string m_inbuf; // partial request data (event loop mode only)
+  bool m_event_loop; // served by an EventLoop, so nothing may block (see lock_stripes())
+  unsigned m_loop_events; // event loop mode: the epoll events it's registered for
+  bool m_parked; // event loop mode: the request at the front of m_inbuf is waiting for a lock
+  uint64_t m_parked_since_us; // when it first parked (wait-die only waits so long)
+  bool m_input_closed; // event loop mode: the client won't send any more
+  bool m_closing; // event loop mode: BYE or an ERROR, close once the replies are sent
+  bool m_input_stalled; // event loop mode: stopped handling requests until m_outbuf drains
+  bool m_write_blocked; // event loop mode: the socket took only part of m_outbuf
+  size_t m_held_from; // event loop mode: where the first reply waiting for m_held_lsn starts (npos if none)
+  unsigned long m_held_lsn; // to be durable before m_outbuf can be sent
+  bool m_in_call; // running a CALL's steps, which can't be parked halfway through
+  std::string m_outbuf; // replies not yet sent, written in one go per batch of requests
+  Message m_request; // decoded request, reused so decoding doesn't allocate
+  Message m_reply; // reply being built, reused so replying doesn't allocate
+  bool m_binary; // client speaks the binary framed protocol (see MessageSerialization)
+  bool m_protocol_known; // event loop mode: whether the first byte has arrived yet
+  std::string m_frame; // payload of the binary request being read (thread modes)
+  std::vector<Value> m_batch; // values of an MGET/MSET, reused between requests
+  std::string m_proc_name; // procedure being recorded (DEFPROC..ENDPROC), empty if none
+  std::vector<Message> m_proc_steps; // requests recorded for it so far
+  std::vector<std::pair<std::string, Value>> m_scan; // entries found by a SCAN/PREFIX
+
+  // optimistic transactions: reads and writes are buffered here until COMMIT
+  struct OccRead {
+    bool found; // whether the key existed
+    Value value; // committed value that was read
+    unsigned long version; // stripe commit version at the time of the read
+  };
+  bool m_optimistic; // current transaction uses optimistic concurrency control
+  std::map<std::pair<Table*, std::string>, OccRead> m_read_set;
+  std::map<std::pair<Table*, std::string>, Value> m_write_set;
+  bool m_last_txn_aborted; // so a BEGIN after an abort can be counted as a retry
+  unsigned long m_txn_ts; // wait-die timestamp of the current (or last aborted) transaction
+
   // copy constructor and assignment operator are prohibited
   ClientConnection( const ClientConnection & );
   ClientConnection &operator=( const ClientConnection & );
 
 public:
+  // buffered replies are written out once they reach this size
+  static const size_t MAX_OUTBUF = 65536;
+  // most requests a stored procedure can have
+  static const unsigned MAX_PROC_STEPS = 256;
+  // longest a wait-die transaction waits for a stripe before failing
+  static const unsigned MAX_LOCK_WAIT_MS = 100;
+  // most entries one SCAN/PREFIX sends back, whatever limit it asks for
+  static const size_t MAX_SCAN_LIMIT = 1000;
+
   ClientConnection( Server *server, int client_fd );
   ~ClientConnection();
 
   void chat_with_client();
+  void chat_text(char first); // chat_with_client for each protocol; the first
+  void chat_binary();         // byte has already been read to pick one
+
+  // Event loop mode: the fd is made non-blocking, and nothing the
+  // connection does waits, for another connection (a request that needs
+  // a lock someone else holds is parked, see lock_stripes()), for the
+  // client (unsent replies wait for EPOLLOUT) or for the disk (replies
+  // to commits are held back until the log says they're durable).
+  void start_event_loop_mode();
+  // read available data and handle all complete requests
+  void handle_readable();
+  // handle and send what can be now (e.g. retry a parked request, send
+  // replies whose commits are now durable, or more of the unsent ones)
+  void resume();
+  bool is_parked() const { return m_parked; }
+  // when a parked wait-die wait gives up (ServerMetrics::now_us), or 0 if
+  // the request isn't one, so only a stripe being unlocked can let it go on
+  uint64_t get_park_deadline_us() const
+  {
+    return m_parked_since_us == 0 ? 0 : m_parked_since_us + MAX_LOCK_WAIT_MS * 1000;
+  }
+  bool is_waiting_durable() const { return m_held_from != std::string::npos; }
+  bool wants_input() const { return !m_input_closed && !m_closing && !m_parked && !m_input_stalled; }
+  bool wants_output() const { return m_write_blocked; }
+  bool is_finished() const; // the loop should close the connection
+  unsigned get_loop_events() const { return m_loop_events; }
+  void set_loop_events( unsigned events ) { m_loop_events = events; }
+  int get_fd() const { return m_client_fd; }
 
   // TODO: additional member functions
-  Message process_handling(Message msg);
+  bool handle_request(std::string_view client_msg_str); // returns false when chat is over
+  const Message &process_handling(const Message &msg);
   //process handling
-  Message login(Message msg);
-  Message create(Message msg);
-  Message push(Message msg);
-  Message pop();
-  Message top();
-  Message set(Message msg);
-  Message get(Message msg);
-  Message handle_arithmetic(MessageType type);
-  Message begin();
-  Message commit();
-  Message bye();
+  const Message &login(const Message &msg);
+  const Message &create(const Message &msg);
+  const Message &push(const Message &msg);
+  const Message &pop();
+  const Message &top();
+  const Message &set(const Message &msg);
+  const Message &get(const Message &msg);
+  const Message &mget(const Message &msg);
+  const Message &mset(const Message &msg);
+  const Message &fetch_and_op(const Message &msg); // INCR, FADD, FSUB, FMUL
+  const Message &defproc(const Message &msg);
+  const Message &record_step(const Message &msg); // a request between DEFPROC and ENDPROC
+  const Message &endproc();
+  const Message &call(const Message &msg);
+  const Message &stats(const Message &msg); // STATS [<command>]
+  const Message &scan(const Message &msg); // SCAN and PREFIX
+  const Message &handle_arithmetic(MessageType type);
+  const Message &begin();
+  const Message &commit();
+  const Message &bye();
   //success replies
-  Message reply_ok();
-  Message reply_data(std::string value);
-  //autocommit
-  void autocommit_lock(Table* table_ptr);
-  void autocommit_unlock(Table* table_ptr);
+  const Message &reply_ok();
+  const Message &reply_data(std::string_view value);
+  const Message &reply_value(const Value &value); // DATA with the value as text
   //more helper
-  Table* get_server_table(std::string table_name);
-  bool string_is_digit(std::string& str);
-  std::string do_arithmetic(MessageType type, unsigned left, unsigned right);
+  Table* get_server_table(const std::string &table_name);
+  static char arithmetic_op(MessageType type); // ADD -> '+' etc.
   //error handling
   void handle_error(const std::string error_msg, MessageType error_type);
-  Message reply_error(const std::string error_msg);
-  Message reply_failed(const std::string error_msg);
-  // send back
-  void respond(Message reply);
+  const Message &reply_error(const std::string &error_msg);
+  const Message &reply_failed(const std::string &error_msg);
+  // send back (replies are buffered until flush_replies)
+  void respond(const Message &reply);
+  void flush_replies();
+  // don't acknowledge a commit until lsn is durable: wait for it, or in
+  // event loop mode hold this reply (and the ones after it) back
+  void wait_durable(unsigned long lsn);
+  bool has_buffered_request(); // a complete request is already in m_fdbuf
+  void process_input(); // event loop mode: handle the complete requests in m_inbuf
   //checks
   void check_has_logged_in();
   void check_empty_stack(const std::string error_msg);
   // more helper functions
   void rollback_trans(); // rollback a transaction 
-  void lock_table(Table *table); // locks table right away in autocommit mode, uses trylock for trans mode
-  void unlock_table(Table *table); // unlocks when in autocommit mode, doesn't do anything in trans mode
+  unsigned long commit_locked_stripes(); // log and commit a locking transaction's changes, returns the LSN
+  const Message &commit_optimistic(); // validate and apply an optimistic transaction
+  const Value &get_optimistic(Table *table, const std::string &key); // GET in an optimistic transaction
+  void set_optimistic(Table *table, const std::string &key); // SET in an optimistic transaction
+  void lock_key(Table *table, const std::string &key); // locks key's stripe right away in autocommit mode, uses trylock (or wait-die) for trans mode
+  // lock the stripes, in (table, stripe) order, for the length of one
+  // request; in event loop mode, parks the request if any is held
+  void lock_stripes(const std::set<std::pair<Table*, unsigned>> &stripes);
+  void park(); // throws RequestParked
+  void unlock_key(Table *table, const std::string &key); // unlocks when in autocommit mode, doesn't do anything in trans mode
     
 };
 
@@ -0,0 +1,82 @@
+#include "client_op.h"
+
+ClientOp::ClientOp()
+  : m_data_index( -1 )
+{
+}
+
+ClientOp ClientOp::get( const std::string &table, const std::string &key )
+{
+  ClientOp op;
+  op.m_requests = { Message(MessageType::GET, {table, key}),
+                    Message(MessageType::TOP),
+                    Message(MessageType::POP) };
+  op.m_expected = { MessageType::OK, MessageType::DATA, MessageType::OK };
+  op.m_data_index = 1;
+  return op;
+}
+
+ClientOp ClientOp::set( const std::string &table, const std::string &key, const std::string &value )
+{
+  ClientOp op;
+  op.m_requests = { Message(MessageType::PUSH, {value}),
+                    Message(MessageType::SET, {table, key}),
+                    Message(MessageType::POP) };
+  op.m_expected = { MessageType::OK, MessageType::OK, MessageType::NONE };
+  return op;
+}
+
+ClientOp ClientOp::incr( const std::string &table, const std::string &key, bool use_transaction )
+{
+  // if GET fails, ADD consumes the 1 and fails, and SET fails on the
+  // empty stack; a failed transaction is rolled back, so COMMIT fails too
+  ClientOp op;
+  if (use_transaction) {
+    op.m_requests.push_back(Message(MessageType::BEGIN));
+  }
+  op.m_requests.push_back(Message(MessageType::GET, {table, key}));
+  op.m_requests.push_back(Message(MessageType::PUSH, {"1"}));
+  op.m_requests.push_back(Message(MessageType::ADD));
+  op.m_requests.push_back(Message(MessageType::SET, {table, key}));
+  if (use_transaction) {
+    op.m_requests.push_back(Message(MessageType::COMMIT));
+  }
+  op.m_requests.push_back(Message(MessageType::POP));
+  op.m_expected.assign(op.m_requests.size(), MessageType::OK);
+  op.m_expected.back() = MessageType::NONE;
+  return op;
+}
+
+bool ClientOp::is_valid() const
+{
+  for (const Message &msg : m_requests) {
+    if (!msg.is_valid()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ClientOp::check( const std::vector<Message> &replies, std::string &result ) const
+{
+  if (replies.size() < m_requests.size()) {
+    result = "could not read response from server";
+    return false;
+  }
+  for (size_t i = 0; i < m_requests.size(); i++) {
+    MessageType type = replies[i].get_message_type();
+    if (m_expected[i] == MessageType::NONE || type == m_expected[i]) {
+      continue;
+    }
+    if (type == MessageType::ERROR || type == MessageType::FAILED) {
+      result = replies[i].get_quoted_text();
+    } else {
+      result = "bad server response";
+    }
+    return false;
+  }
+  if (m_data_index >= 0) {
+    result = replies[m_data_index].get_value();
+  }
+  return true;
+}
@@ -0,0 +1,42 @@
+#ifndef CLIENT_OP_H
+#define CLIENT_OP_H
+
+#include <string>
+#include <vector>
+#include "message.h"
+
+// The requests that carry out one client-level operation, ready to be
+// pipelined along with others on a ClientUtil connection.
+//
+// Every sequence leaves the stack empty whether it succeeds or fails,
+// so a failure can't leak an operand into the operations pipelined
+// after it: a trailing POP that's allowed to fail cleans up a value
+// that a failed SET left behind.
+class ClientOp {
+private:
+  std::vector<Message> m_requests;
+  std::vector<MessageType> m_expected; // reply type per request (NONE: don't care)
+  int m_data_index; // index of the reply holding the result (-1 if none)
+
+public:
+  ClientOp();
+
+  static ClientOp get( const std::string &table, const std::string &key );
+  static ClientOp set( const std::string &table, const std::string &key, const std::string &value );
+  // add 1 to the value, optionally in a transaction
+  static ClientOp incr( const std::string &table, const std::string &key, bool use_transaction );
+
+  const std::vector<Message> &get_requests() const { return m_requests; }
+  unsigned get_num_requests() const { return m_requests.size(); }
+  bool has_result() const { return m_data_index >= 0; } // reads a value
+
+  // false if any request is invalid (and would end the session with ERROR)
+  bool is_valid() const;
+
+  // check the replies to the requests: on success returns true and sets
+  // result to the value read (if any); otherwise sets result to the
+  // reason from the first reply that went wrong
+  bool check( const std::vector<Message> &replies, std::string &result ) const;
+};
+
+#endif // CLIENT_OP_H
@@ -0,0 +1,142 @@
+#include <iostream>
+#include "exceptions.h"
+#include "message_serialization.h"
+#include "client_util.h"
+
+ClientUtil::ClientUtil()
+  : m_fd( -1 )
+  , m_binary( false )
+{
+}
+
+ClientUtil::~ClientUtil()
+{
+  close();
+}
+
+void ClientUtil::connect( const std::string &hostname, const std::string &port, bool binary )
+{
+  m_fd = open_clientfd(hostname.c_str(), port.c_str());
+  if (m_fd < 0) {
+    throw CommException("cannot establish connection to server");
+  }
+  rio_readinitb(&m_rio, m_fd);
+
+  // the server picks the protocol from the first byte it reads
+  m_binary = binary;
+  if (m_binary) {
+    char magic = char(MessageSerialization::BINARY_MAGIC);
+    if (rio_writen(m_fd, &magic, 1) != 1) {
+      throw CommException("could not send request to server");
+    }
+  }
+}
+
+void ClientUtil::close()
+{
+  if (m_fd >= 0) {
+    Close(m_fd);
+    m_fd = -1;
+  }
+}
+
+Message ClientUtil::request( const Message &msg )
+{
+  std::vector<Message> replies;
+  pipeline({ msg }, replies);
+  if (replies.empty()) {
+    throw CommException("could not read response from server");
+  }
+  return replies[0];
+}
+
+void ClientUtil::pipeline( const std::vector<Message> &requests, std::vector<Message> &replies )
+{
+  send(requests);
+  replies.clear();
+  Message reply;
+  while (replies.size() < requests.size() && receive(reply)) {
+    replies.push_back(reply);
+  }
+}
+
+void ClientUtil::send( const std::vector<Message> &requests )
+{
+  std::string encoded_requests;
+  for (const Message &msg : requests) {
+    if (m_binary) {
+      MessageSerialization::encode_binary_append(msg, encoded_requests);
+    } else {
+      MessageSerialization::encode_append(msg, encoded_requests);
+    }
+  }
+  if (rio_writen(m_fd, encoded_requests.c_str(), encoded_requests.length()) != ssize_t(encoded_requests.length())) {
+    throw CommException("could not send request to server");
+  }
+}
+
+bool ClientUtil::run( const std::vector<Message> &requests, std::vector<Message> &replies,
+                      const std::vector<MessageType> &expected_types )
+{
+  pipeline(requests, replies);
+  return check_replies(requests.size(), replies, expected_types);
+}
+
+bool ClientUtil::check_replies( size_t num_requests, const std::vector<Message> &replies,
+                                const std::vector<MessageType> &expected_types )
+{
+  for (size_t i = 0; i < num_requests; i++) {
+    if (i >= replies.size()) {
+      std::cerr << "Error: could not read response from server\n";
+      return false;
+    }
+    MessageType expected = i < expected_types.size() ? expected_types[i] : MessageType::OK;
+    if (!check_reply(replies[i], expected)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ClientUtil::check_reply( const Message &reply, MessageType expected )
+{
+  MessageType type = reply.get_message_type();
+  if (type == expected) {
+    return true;
+  }
+  if (type == MessageType::ERROR || type == MessageType::FAILED) {
+    std::cerr << "Error: " << reply.get_quoted_text() << "\n";
+  } else {
+    std::cerr << "Error: bad server response\n";
+  }
+  return false;
+}
+
+bool ClientUtil::receive( Message &reply )
+{
+  if (m_binary) {
+    char header[MessageSerialization::BINARY_HEADER_LEN];
+    uint32_t len;
+    if (rio_readnb(&m_rio, header, sizeof(header)) != sizeof(header)) {
+      return false;
+    }
+    MessageSerialization::binary_frame_len(std::string_view(header, sizeof(header)), len);
+    if (len > Message::MAX_BINARY_LEN) {
+      throw InvalidMessage("reply from server is too long");
+    }
+    std::string payload(len, '\0');
+    if (rio_readnb(&m_rio, &payload[0], len) != ssize_t(len)) {
+      return false;
+    }
+    MessageSerialization::decode_binary(payload, reply);
+    return true;
+  }
+
+  char buf[Message::MAX_ENCODED_LEN];
+  ssize_t length = rio_readlineb(&m_rio, buf, Message::MAX_ENCODED_LEN);
+  if (length <= 0) {
+    return false;
+  }
+  MessageSerialization::decode(std::string(buf, length), reply);
+  return true;
+}
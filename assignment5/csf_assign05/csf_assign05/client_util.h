@@ -0,0 +1,70 @@
+#ifndef CLIENT_UTIL_H
+#define CLIENT_UTIL_H
+
+#include <string>
+#include <vector>
+#include "csapp.h"
+#include "message.h"
+
+// Client side of a connection to the server, shared by all clients.
+//
+// Requests can be sent one at a time (request()), or pipelined: the
+// whole sequence is written at once and the replies read afterwards,
+// so the sequence costs one round trip instead of one per request.
+// The server keeps handling the rest of a pipelined sequence after a
+// request fails, so only pipeline sequences where a failure makes the
+// requests that depend on it fail too (e.g. GET/PUSH/ADD/SET, where a
+// failed GET leaves ADD without an operand and SET with an empty stack).
+class ClientUtil {
+private:
+  int m_fd;
+  rio_t m_rio;
+  bool m_binary; // speaking the binary framed protocol
+
+  // copy constructor and assignment operator are prohibited
+  ClientUtil( const ClientUtil & );
+  ClientUtil &operator=( const ClientUtil & );
+
+public:
+  ClientUtil();
+  ~ClientUtil();
+
+  // throws CommException if the connection can't be made.
+  // binary selects the length-prefixed protocol (see MessageSerialization),
+  // which is cheaper to parse and allows values longer than a text line
+  void connect( const std::string &hostname, const std::string &port, bool binary = false );
+  void close();
+
+  // send one request and read its reply
+  // (throws CommException if the connection is lost, InvalidMessage
+  // if the reply can't be decoded)
+  Message request( const Message &msg );
+
+  // send every request in one write, then read a reply for each.
+  // Stops reading early if the server closes the connection (e.g.
+  // after an ERROR), so replies may be shorter than requests.
+  void pipeline( const std::vector<Message> &requests, std::vector<Message> &replies );
+
+  // the two halves of pipeline(): send requests in one write (throws
+  // CommException on failure), and read and decode the next reply
+  // (returns false if the server closed the connection)
+  void send( const std::vector<Message> &requests );
+  bool receive( Message &reply );
+
+  // pipeline the requests and check that every reply has the expected
+  // type (OK unless given in expected_types, which may be shorter than
+  // requests). On the first bad reply, prints an error message and
+  // returns false.
+  bool run( const std::vector<Message> &requests, std::vector<Message> &replies,
+            const std::vector<MessageType> &expected_types = std::vector<MessageType>() );
+
+  // the checking half of run(), for replies to num_requests pipelined requests
+  static bool check_replies( size_t num_requests, const std::vector<Message> &replies,
+                             const std::vector<MessageType> &expected_types = std::vector<MessageType>() );
+
+  // print an error for reply (the server's explanation for ERROR and
+  // FAILED) and return false unless it has the expected type
+  static bool check_reply( const Message &reply, MessageType expected = MessageType::OK );
+};
+
+#endif // CLIENT_UTIL_H
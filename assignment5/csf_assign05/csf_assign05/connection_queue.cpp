@@ -0,0 +1,85 @@
+#include "guard.h"
+#include "connection_queue.h"
+
+namespace {
+
+double elapsed_ms( const struct timespec &start, const struct timespec &end )
+{
+  return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+}
+
+ConnectionQueue::ConnectionQueue( unsigned capacity )
+  : m_mutex_profile( "queue" )
+  , m_capacity( capacity )
+  , m_stats()
+{
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_not_empty, NULL);
+  pthread_cond_init(&m_not_full, NULL);
+}
+
+ConnectionQueue::~ConnectionQueue()
+{
+  pthread_cond_destroy(&m_not_full);
+  pthread_cond_destroy(&m_not_empty);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+bool ConnectionQueue::push( int fd, bool wait_if_full )
+{
+  Guard g(m_mutex, m_mutex_profile);
+  if (m_queue.size() >= m_capacity) {
+    if (!wait_if_full) {
+      m_stats.refused++;
+      return false;
+    }
+    m_stats.delayed++;
+    while (m_queue.size() >= m_capacity) { // backpressure: stop accepting until a worker frees a slot
+      pthread_cond_wait(&m_not_full, &m_mutex);
+    }
+  }
+
+  Entry entry;
+  entry.fd = fd;
+  clock_gettime(CLOCK_MONOTONIC, &entry.enqueued_at);
+  m_queue.push_back(entry);
+
+  m_stats.enqueued++;
+  if (m_queue.size() > m_stats.max_depth) {
+    m_stats.max_depth = m_queue.size();
+  }
+  pthread_cond_signal(&m_not_empty);
+  return true;
+}
+
+int ConnectionQueue::pop()
+{
+  Guard g(m_mutex, m_mutex_profile);
+  while (m_queue.empty()) {
+    pthread_cond_wait(&m_not_empty, &m_mutex);
+  }
+  Entry entry = m_queue.front();
+  m_queue.pop_front();
+
+  // record how long the connection waited for a worker
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double wait_ms = elapsed_ms(entry.enqueued_at, now);
+  m_stats.dequeued++;
+  m_stats.total_wait_ms += wait_ms;
+  if (wait_ms > m_stats.max_wait_ms) {
+    m_stats.max_wait_ms = wait_ms;
+  }
+  pthread_cond_signal(&m_not_full);
+  return entry.fd;
+}
+
+ConnectionQueueStats ConnectionQueue::get_stats()
+{
+  Guard g(m_mutex, m_mutex_profile);
+  ConnectionQueueStats stats = m_stats;
+  stats.depth = m_queue.size();
+  return stats;
+}
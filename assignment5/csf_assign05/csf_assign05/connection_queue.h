@@ -0,0 +1,55 @@
+#ifndef CONNECTION_QUEUE_H
+#define CONNECTION_QUEUE_H
+
+#include <deque>
+#include <ctime>
+#include <pthread.h>
+#include "lock_profiler.h"
+
+// Snapshot of the queue counters (used to size the worker pool)
+struct ConnectionQueueStats {
+  unsigned depth;              // connections currently waiting
+  unsigned max_depth;          // high water mark
+  unsigned long enqueued;      // connections accepted into the queue
+  unsigned long dequeued;      // connections handed to a worker
+  unsigned long refused;       // connections turned away because the queue was full
+  unsigned long delayed;       // accepts that had to wait for room in the queue
+  double total_wait_ms;        // total time connections spent queued
+  double max_wait_ms;          // longest time a connection spent queued
+};
+
+// Bounded FIFO of accepted client fds, consumed by the worker pool.
+class ConnectionQueue {
+private:
+  struct Entry {
+    int fd;
+    struct timespec enqueued_at;
+  };
+
+  pthread_mutex_t m_mutex;
+  LockProfiler::Counters m_mutex_profile;
+  pthread_cond_t m_not_empty;
+  pthread_cond_t m_not_full;
+  std::deque<Entry> m_queue;
+  unsigned m_capacity;
+  ConnectionQueueStats m_stats;
+
+  // copy constructor and assignment operator are prohibited
+  ConnectionQueue( const ConnectionQueue & );
+  ConnectionQueue &operator=( const ConnectionQueue & );
+
+public:
+  ConnectionQueue( unsigned capacity );
+  ~ConnectionQueue();
+
+  // Add fd to the queue. If the queue is full, either wait for room
+  // (wait_if_full) or return false right away without queueing it.
+  bool push( int fd, bool wait_if_full );
+
+  // Remove the oldest fd, waiting until one is available.
+  int pop();
+
+  ConnectionQueueStats get_stats();
+};
+
+#endif // CONNECTION_QUEUE_H
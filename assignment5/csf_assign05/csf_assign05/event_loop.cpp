@@ -0,0 +1,190 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include "csapp.h"
+#include "server.h"
+#include "client_connection.h"
+#include "table.h"
+#include "event_loop.h"
+
+EventLoop::EventLoop( Server *server )
+  : m_server( server )
+  , m_epoll_fd( -1 )
+  , m_wake_fd( -1 )
+  , m_parked_added( false )
+{
+  m_epoll_fd = epoll_create1(0);
+  if(m_epoll_fd < 0){
+    m_server->fatal("Could not create epoll instance: " + std::string(strerror(errno)));
+  }
+  m_wake_fd = eventfd(0, EFD_NONBLOCK);
+  if(m_wake_fd < 0){
+    m_server->fatal("Could not create eventfd: " + std::string(strerror(errno)));
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = nullptr; // not a client
+  if(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev) < 0){
+    m_server->fatal("Could not register eventfd: " + std::string(strerror(errno)));
+  }
+  m_server->add_durable_listener(m_wake_fd);
+  Table::add_unlock_listener(m_wake_fd);
+}
+
+EventLoop::~EventLoop()
+{
+  Close(m_wake_fd);
+  Close(m_epoll_fd);
+}
+
+void EventLoop::start()
+{
+  if(pthread_create(&m_thread, nullptr, loop_worker, this) != 0){
+    m_server->fatal("Could not create event loop thread");
+  }
+  pthread_detach(m_thread); // loops run for the lifetime of the server
+}
+
+void EventLoop::add_client( ClientConnection *client )
+{
+  // level-triggered: the loop is notified again if a read leaves data behind
+  client->start_event_loop_mode();
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.ptr = client;
+  client->set_loop_events(ev.events);
+  if(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, client->get_fd(), &ev) < 0){
+    m_server->log_error("Could not register client: " + std::string(strerror(errno)));
+    delete client;
+  }
+}
+
+void *EventLoop::loop_worker( void *arg )
+{
+  EventLoop *loop = static_cast<EventLoop *>( arg );
+  loop->run();
+  return nullptr;
+}
+
+void EventLoop::run()
+{
+  struct epoll_event events[MAX_EVENTS];
+  std::vector<ClientConnection *> parked, durable;
+  while(true) {
+    int n = epoll_wait(m_epoll_fd, events, MAX_EVENTS, parked_timeout_ms());
+    if(n < 0){
+      if(errno == EINTR) continue;
+      m_server->log_error("epoll_wait failed: " + std::string(strerror(errno)));
+      continue;
+    }
+    bool woken = n == 0; // a wait-die wait's time is up
+    for(int i = 0; i < n; i++){
+      ClientConnection *client = static_cast<ClientConnection *>( events[i].data.ptr );
+      if(client == nullptr){
+        // the log was flushed or a stripe unlocked (handled below, once
+        // the batch is done, since handling it may close clients with
+        // events in the batch)
+        uint64_t count;
+        ssize_t rc = read(m_wake_fd, &count, sizeof(count));
+        (void) rc; // nothing to do if it was already reset
+        woken = true;
+        continue;
+      }
+      if(events[i].events & (EPOLLHUP | EPOLLERR)){
+        close_client(client); // gone for good, nothing more can be sent to it
+        continue;
+      }
+      if(events[i].events & (EPOLLIN | EPOLLRDHUP)){
+        // read whatever is available and handle every complete request
+        client->handle_readable();
+      } else {
+        client->resume(); // writable: send more of the replies
+      }
+      update_client(client);
+    }
+    // send the replies that were waiting for a flush
+    if(woken){
+      durable.assign(m_durable.begin(), m_durable.end());
+      for(ClientConnection *client : durable){
+        client->resume();
+        update_client(client);
+      }
+    }
+    // the locks the parked requests wanted may have been released since.
+    // A newly parked request is tried once more right away, since the
+    // lock may have been released before it was counted as parked (and
+    // so without signalling anyone)
+    if(woken || m_parked_added){
+      m_parked_added = false;
+      parked.assign(m_parked.begin(), m_parked.end());
+      for(ClientConnection *client : parked){
+        client->resume();
+        update_client(client);
+      }
+    }
+  }
+}
+
+int EventLoop::parked_timeout_ms() const
+{
+  uint64_t deadline = 0;
+  for(ClientConnection *client : m_parked){
+    uint64_t d = client->get_park_deadline_us();
+    if(d != 0 && (deadline == 0 || d < deadline)){
+      deadline = d;
+    }
+  }
+  if(deadline == 0){
+    return -1; // woken when a stripe is unlocked
+  }
+  uint64_t now = ServerMetrics::now_us();
+  return deadline <= now ? 0 : int((deadline - now + 999) / 1000);
+}
+
+void EventLoop::update_client( ClientConnection *client )
+{
+  if(client->is_finished()){
+    close_client(client);
+    return;
+  }
+  if(client->is_parked()){
+    if(m_parked.insert(client).second){
+      Table::parked_changed(1);
+      m_parked_added = true;
+    }
+  } else if(m_parked.erase(client) > 0){
+    Table::parked_changed(-1);
+  }
+  if(client->is_waiting_durable()){
+    m_durable.insert(client);
+  } else {
+    m_durable.erase(client);
+  }
+  // stop reading while a request is parked, so requests stay in order,
+  // or while the client isn't reading its replies
+  unsigned events = client->wants_input() ? EPOLLIN | EPOLLRDHUP : 0;
+  if(client->wants_output()){
+    events |= EPOLLOUT;
+  }
+  if(events != client->get_loop_events()){
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = client;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, client->get_fd(), &ev);
+    client->set_loop_events(events);
+  }
+}
+
+void EventLoop::close_client( ClientConnection *client )
+{
+  // deregister before the destructor closes the fd
+  if(m_parked.erase(client) > 0){
+    Table::parked_changed(-1);
+  }
+  m_durable.erase(client);
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, client->get_fd(), nullptr);
+  delete client;
+}
@@ -0,0 +1,56 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <set>
+#include <pthread.h>
+
+class Server; // forward declaration
+class ClientConnection; // forward declaration
+
+// One epoll-based reactor thread. Client fds are registered with
+// add_client() (from the accept thread), and the loop thread reads
+// and handles requests for every connection it owns. All per-connection
+// state lives in the ClientConnection object, not on a thread stack.
+//
+// The loop never waits for a lock another connection holds (that could
+// be a transaction whose COMMIT is sitting unread on this very loop).
+// Such a request is parked instead, and tried again whenever a stripe
+// is unlocked (Table signals m_wake_fd), until it gets its locks. Nor
+// does it wait for a client (fds are non-blocking, and whatever a client
+// won't take yet is sent on EPOLLOUT) or for the disk: replies to
+// commits are held back until the write-ahead log's flusher signals
+// m_wake_fd, so all the commits made on the loop meanwhile share one fsync.
+class EventLoop {
+private:
+  Server *m_server;
+  int m_epoll_fd;
+  int m_wake_fd; // eventfd written after every log flush, and stripe unlock while anything is parked
+  bool m_parked_added; // a request was parked since the parked ones were last tried
+  pthread_t m_thread;
+  std::set<ClientConnection*> m_parked; // connections with a parked request
+  std::set<ClientConnection*> m_durable; // connections with replies waiting for a flush
+
+  // copy constructor and assignment operator are prohibited
+  EventLoop( const EventLoop & );
+  EventLoop &operator=( const EventLoop & );
+
+public:
+  // maximum number of events handled per epoll_wait call
+  static const int MAX_EVENTS = 64;
+
+  EventLoop( Server *server );
+  ~EventLoop();
+
+  void start();
+  void add_client( ClientConnection *client );
+
+  static void *loop_worker( void *arg );
+  void run();
+
+  // helpers
+  int parked_timeout_ms() const; // epoll_wait timeout: until a wait-die wait gives up
+  void update_client( ClientConnection *client ); // after it's handled anything
+  void close_client( ClientConnection *client );
+};
+
+#endif // EVENT_LOOP_H
@@ -56,4 +56,17 @@ public:
   { }
 };
 
+// Exception indicating that (in event loop mode) a request needs a lock
+// another connection holds. Nothing has been changed yet, so rather than
+// block the loop waiting for the lock, the request is tried again later.
+class RequestParked : public std::runtime_error {
+public:
+  RequestParked()
+    : std::runtime_error( "request parked" )
+  { }
+
+  ~RequestParked()
+  { }
+};
+
 #endif // EXCEPTIONS_H
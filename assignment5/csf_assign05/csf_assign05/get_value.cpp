@@ -1,14 +1,48 @@
 #include <iostream>
 #include <string>
-#include "csapp.h"
 #include "message.h"
-#include "message_serialization.h"
 #include "exceptions.h"
+#include "client_util.h"
+
+namespace {
+
+// log in, push every key's value in key order, then read them off the
+// top of the stack (last key first). Several keys use one MGET, unless
+// the server doesn't have it; a single key is a plain GET, which any
+// server understands.
+std::vector<Message> get_requests( const std::string &username, const std::string &table,
+                                   char **keys, unsigned num_keys, bool use_mget,
+                                   std::vector<MessageType> &expected_types )
+{
+  std::vector<Message> requests = { Message(MessageType::LOGIN, {username}) };
+  if (use_mget) {
+    Message mget(MessageType::MGET, {table});
+    for (unsigned i = 0; i < num_keys; i++) {
+      mget.push_arg(keys[i]);
+    }
+    requests.push_back(mget);
+  } else {
+    for (unsigned i = 0; i < num_keys; i++) {
+      requests.push_back(Message(MessageType::GET, {table, keys[i]}));
+    }
+  }
+  expected_types.assign(requests.size(), MessageType::OK);
+  for (unsigned i = 0; i < num_keys; i++) {
+    requests.push_back(Message(MessageType::TOP));
+    requests.push_back(Message(MessageType::POP));
+    expected_types.push_back(MessageType::DATA);
+    expected_types.push_back(MessageType::OK);
+  }
+  requests.push_back(Message(MessageType::BYE));
+  return requests;
+}
+
+}
 
 int main(int argc, char **argv)
 {
-  if ( argc != 6 ) {
-    std::cerr << "Usage: ./get_value <hostname> <port> <username> <table> <key>\n";
+  if ( argc < 6 ) {
+    std::cerr << "Usage: ./get_value <hostname> <port> <username> <table> <key> [<key>...]\n";
     return 1;
   }
 
@@ -16,128 +50,46 @@ int main(int argc, char **argv)
   std::string port = argv[2];
   std::string username = argv[3];
   std::string table = argv[4];
-  std::string key = argv[5];
-
-  int clientfd;
-  rio_t rio;
+  unsigned num_keys = argc - 5;
 
-  clientfd = open_clientfd(hostname.c_str(), port.c_str());
-  if (clientfd < 0) {
-    std::cerr << "Error: cannot establish connection to server\n";
-    return 1;
-  }
-
-  rio_readinitb(&rio, clientfd);
-
-  // send message for LOGIN 
   try {
-    Message login_msg(MessageType::LOGIN, {username});
-    std::string encoded_message;
-    MessageSerialization::encode(login_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read response
-    char buf[Message::MAX_ENCODED_LEN];
-    ssize_t length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read response from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    Message response;
-    MessageSerialization::decode(std::string(buf, length),response);
-
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
+    ClientUtil client;
+    client.connect(hostname, port);
+
+    // send every request at once (one round trip), then check the replies.
+    // If a GET fails the stack is short a value, so a TOP fails too.
+    bool use_mget = num_keys > 1;
+    std::vector<MessageType> expected_types;
+    std::vector<Message> requests = get_requests(username, table, argv + 5, num_keys, use_mget, expected_types);
+    std::vector<Message> replies;
+    client.pipeline(requests, replies);
+
+    if (use_mget && replies.size() > 1 && replies[1].get_message_type() == MessageType::ERROR) {
+      // a server without MGET drops the connection, so start over with a GET per key
+      client.close();
+      client.connect(hostname, port);
+      requests = get_requests(username, table, argv + 5, num_keys, false, expected_types);
+      client.pipeline(requests, replies);
     }
 
-    // send message for GET
-    Message get_msg(MessageType::GET, {table, key});
-    MessageSerialization::encode(get_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    // send message for TOP
-    Message top_msg(MessageType::TOP);
-    MessageSerialization::encode(top_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read from server
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length  <= 0) {
-      std::cerr << "Error: could not read from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() == MessageType::DATA) {
-      std::cout << response.get_value() << "\n";
-    } else {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
+    if (!ClientUtil::check_replies(requests.size(), replies, expected_types)) {
       return 1;
     }
-
-    // send message for BYE 
-    Message bye_msg(MessageType::BYE);
-    MessageSerialization::encode(bye_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read from server 
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read from the server\n";
-      Close(clientfd);
-      return 1;
+    // the TOPs read the values last key first, so print them in reverse
+    size_t first_top = requests.size() - 1 - 2 * num_keys;
+    for (unsigned i = num_keys; i > 0; i--) {
+      std::cout << replies[first_top + 2 * (i - 1)].get_value() << "\n";
     }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    Close(clientfd);
     return 0;
 
+  } catch (CommException &ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    return 1;
   } catch (InvalidMessage &ex) {
     std::cerr << "Error: " << ex.what() << "\n";
-    Close(clientfd);
     return 1;
   } catch (...) {
     std::cerr << "Error: unexpected error\n";
-    Close(clientfd);
     return 1;
   }
 }
@@ -2,6 +2,7 @@
 #define GUARD_H
 
 #include <pthread.h>
+#include "lock_profiler.h"
 
 class Guard {
 private:
@@ -18,6 +19,13 @@ public:
     pthread_mutex_lock( &m_lock );
   }
 
+  // lock through the lock's profiler counters (see LockProfiler)
+  Guard( pthread_mutex_t &lock, LockProfiler::Counters &counters )
+    : m_lock( lock )
+  {
+    LockProfiler::lock( m_lock, counters );
+  }
+
   ~Guard()
   {
     pthread_mutex_unlock( &m_lock );
@@ -0,0 +1,141 @@
+#include <functional>
+#include <utility>
+#include "hash_store.h"
+
+HashStore::HashStore()
+  : m_slots( INITIAL_CAPACITY )
+  , m_size( 0 )
+{
+}
+
+HashStore::~HashStore()
+{
+}
+
+size_t HashStore::hash_of( const std::string &key )
+{
+  // Table picks a key's stripe from std::hash modulo the stripe count, so
+  // every key in one store shares the same low bits. Mix the bits (64-bit
+  // murmur3 finalizer) before masking, or those keys would all pile up in
+  // a small fraction of the slots.
+  unsigned long long h = std::hash<std::string>()(key);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+long HashStore::find_slot( const std::string &key, size_t hash ) const
+{
+  size_t i = hash & mask();
+  while (m_slots[i].used) {
+    if (m_slots[i].hash == hash && m_slots[i].key == key) {
+      return i;
+    }
+    i = (i + 1) & mask();
+  }
+  return -1; // hit an empty slot, so key isn't here
+}
+
+void HashStore::grow()
+{
+  std::vector<Slot> old_slots(m_slots.size() * 2);
+  old_slots.swap(m_slots);
+  for (Slot &slot : old_slots) {
+    if (slot.used) {
+      size_t i = slot.hash & mask();
+      while (m_slots[i].used) {
+        i = (i + 1) & mask();
+      }
+      m_slots[i] = std::move(slot);
+    }
+  }
+}
+
+bool HashStore::get( const std::string &key, Value &value ) const
+{
+  long i = find_slot(key, hash_of(key));
+  if (i < 0) {
+    return false;
+  }
+  value = m_slots[i].value;
+  return true;
+}
+
+void HashStore::set( const std::string &key, const Value &value )
+{
+  size_t hash = hash_of(key);
+  long found = find_slot(key, hash);
+  if (found >= 0) {
+    m_slots[found].value = value;
+    return;
+  }
+
+  // keep the load factor under 0.7 so probe sequences stay short
+  if ((m_size + 1) * 10 > m_slots.size() * 7) {
+    grow();
+  }
+  size_t i = hash & mask();
+  while (m_slots[i].used) {
+    i = (i + 1) & mask();
+  }
+  Slot &slot = m_slots[i];
+  slot.hash = hash;
+  slot.used = true;
+  slot.key = key;
+  slot.value = value;
+  m_size++;
+}
+
+bool HashStore::has_key( const std::string &key ) const
+{
+  return find_slot(key, hash_of(key)) >= 0;
+}
+
+void HashStore::erase( const std::string &key )
+{
+  long found = find_slot(key, hash_of(key));
+  if (found < 0) {
+    return;
+  }
+
+  // backward-shift deletion: pull later entries of the probe run back
+  // into the hole so lookups never need tombstones
+  size_t hole = found;
+  size_t j = hole;
+  while (true) {
+    j = (j + 1) & mask();
+    if (!m_slots[j].used) {
+      break;
+    }
+    size_t home = m_slots[j].hash & mask();
+    // entry at j may move to the hole only if its home slot is not
+    // cyclically within (hole, j]
+    bool home_between = (hole <= j) ? (hole < home && home <= j)
+                                    : (hole < home || home <= j);
+    if (!home_between) {
+      m_slots[hole] = std::move(m_slots[j]);
+      hole = j;
+    }
+  }
+  m_slots[hole].used = false;
+  m_slots[hole].key.clear();
+  m_slots[hole].value = Value();
+  m_size--;
+}
+
+size_t HashStore::size() const
+{
+  return m_size;
+}
+
+void HashStore::for_each( const EntryFn &fn ) const
+{
+  for (const Slot &slot : m_slots) {
+    if (slot.used) {
+      fn(slot.key, slot.value);
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef HASH_STORE_H
+#define HASH_STORE_H
+
+#include <vector>
+#include <string>
+#include "table_store.h"
+
+// Open-addressing hash table engine (linear probing, backward-shift
+// deletion, so there are no tombstones). Entries live directly in one
+// flat array of slots; each slot caches the full hash so most probes
+// are rejected without touching the key, and short keys/values are
+// stored inline in the slot by std::string's small string buffer.
+class HashStore : public TableStore {
+private:
+  struct Slot {
+    size_t hash;  // full (mixed) hash of key, valid only if used
+    bool used;
+    std::string key;
+    Value value;
+
+    Slot() : hash( 0 ), used( false ) { }
+  };
+
+  std::vector<Slot> m_slots; // size is always a power of 2
+  size_t m_size;
+
+  // copy constructor and assignment operator are prohibited
+  HashStore( const HashStore & );
+  HashStore &operator=( const HashStore & );
+
+  static size_t hash_of( const std::string &key );
+  size_t mask() const { return m_slots.size() - 1; }
+  // index of slot holding key, or -1 if not present
+  long find_slot( const std::string &key, size_t hash ) const;
+  void grow();
+
+public:
+  static const size_t INITIAL_CAPACITY = 16;
+
+  HashStore();
+  virtual ~HashStore();
+
+  virtual bool get( const std::string &key, Value &value ) const;
+  virtual void set( const std::string &key, const Value &value );
+  virtual bool has_key( const std::string &key ) const;
+  virtual void erase( const std::string &key );
+  virtual size_t size() const;
+  virtual void for_each( const EntryFn &fn ) const;
+
+  size_t capacity() const { return m_slots.size(); }
+};
+
+#endif // HASH_STORE_H
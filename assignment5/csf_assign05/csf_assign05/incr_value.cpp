@@ -1,9 +1,29 @@
 #include <iostream>
 #include <string>
-#include "csapp.h"
 #include "message.h"
-#include "message_serialization.h"
 #include "exceptions.h"
+#include "client_util.h"
+
+namespace {
+
+// log in, do the increment (in a transaction if asked), log out
+std::vector<Message> increment_requests( const std::string &username, bool use_transaction,
+                                         const std::vector<Message> &increment )
+{
+  std::vector<Message> requests;
+  requests.push_back(Message(MessageType::LOGIN, {username}));
+  if (use_transaction) {
+    requests.push_back(Message(MessageType::BEGIN));
+  }
+  requests.insert(requests.end(), increment.begin(), increment.end());
+  if (use_transaction) {
+    requests.push_back(Message(MessageType::COMMIT));
+  }
+  requests.push_back(Message(MessageType::BYE));
+  return requests;
+}
+
+}
 
 int main(int argc, char **argv) {
   if ( argc != 6 && (argc != 7 || std::string(argv[1]) != "-t") ) {
@@ -27,230 +47,49 @@ int main(int argc, char **argv) {
   std::string table = argv[count++];
   std::string key = argv[count++];
 
-  // TODO: implement
-  
-  int clientfd;
-  rio_t rio;
-
-  // open the server
-  clientfd = open_clientfd(hostname.c_str(), port.c_str());
-  if (clientfd < 0) {
-    std::cerr << "Error: can't establish server connection\n";
-    return 1;
-  }
-  rio_readinitb(&rio, clientfd);
-
-  // send the message for LOGIN
   try {
-    Message login_msg(MessageType::LOGIN, {username});
-    std::string encoded_message;
-    MessageSerialization::encode(login_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read the response from server 
-    char buf[Message::MAX_ENCODED_LEN];
-    ssize_t length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: message could not be read from the server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    // decode the response from server 
-    Message response;
-    MessageSerialization::decode(std::string(buf, length), response);
-    
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-    
-    // send the begin message
-    if (use_transaction) {
-      Message begin_msg(MessageType::BEGIN);
-      MessageSerialization::encode(begin_msg, encoded_message);
-      rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-      // read the response
-      length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-      if (length <= 0) {
-        std::cerr << "Error: couldn't read response from server\n";
-        Close(clientfd);
-        return 1;
-      }
-      
-      MessageSerialization::decode(std::string(buf, length), response);
-
-      if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-        std::cerr << "Error: " << response.get_quoted_text() << "\n";
-        Close(clientfd);
-        return 1;
-      } else if (response.get_message_type() != MessageType::OK) {
-        std::cerr << "Error: bad server response\n";
-        Close(clientfd);
-        return 1;
-      }
-    }
-
-    // send message for GET
-    Message get_msg(MessageType::GET, {table, key});
-    MessageSerialization::encode(get_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read the response from the server 
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read response from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    // send message for PUSH 1
-    Message push_msg(MessageType::PUSH, {"1"});
-    MessageSerialization::encode(push_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read from server
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read from server\n";
-      Close(clientfd);
-      return 1;
+    ClientUtil client;
+    client.connect(hostname, port);
+
+    // the server increments the key itself, holding its lock only for
+    // the arithmetic (with -t, inside a transaction of its own)
+    size_t incr_index = use_transaction ? 2 : 1;
+    std::vector<Message> requests = increment_requests(username, use_transaction, {
+      Message(MessageType::INCR, {table, key}),
+    });
+    std::vector<Message> replies;
+    client.pipeline(requests, replies);
+
+    if (replies.size() > incr_index && replies[incr_index].get_message_type() == MessageType::ERROR) {
+      // a server without INCR drops the connection, so start over and
+      // read, add and write back instead. A failure cascades safely: if
+      // GET fails the stack stays empty, so ADD consumes the 1 and fails,
+      // and SET fails on the empty stack; a failed transaction is rolled
+      // back, so COMMIT fails as well.
+      client.close();
+      client.connect(hostname, port);
+      requests = increment_requests(username, use_transaction, {
+        Message(MessageType::GET, {table, key}),
+        Message(MessageType::PUSH, {"1"}),
+        Message(MessageType::ADD),
+        Message(MessageType::SET, {table, key}),
+      });
+      client.pipeline(requests, replies);
     }
 
-    MessageSerialization::decode(std::string(buf, length), response);
-
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
+    if (!ClientUtil::check_replies(requests.size(), replies)) {
       return 1;
     }
-
-    // send the message for ADD 
-    Message add_msg(MessageType::ADD);
-    MessageSerialization::encode(add_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read the response from server 
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    // send the message for SET  
-    Message set_msg(MessageType::SET, {table, key});
-    MessageSerialization::encode(set_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // Read response
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    // send message for COMMIT
-    if (use_transaction) {
-      Message commit_msg(MessageType::COMMIT);
-      MessageSerialization::encode(commit_msg, encoded_message);
-      rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-      // read from server 
-      length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-      if (length <= 0) {
-        std::cerr << "Error: could not read response from server\n";
-        Close(clientfd);
-        return 1;
-      }
-
-      MessageSerialization::decode(std::string(buf, length), response);
-      if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-        std::cerr << "Error: " << response.get_quoted_text() << "\n";
-        Close(clientfd);
-        return 1;
-      } else if (response.get_message_type() != MessageType::OK) {
-        std::cerr << "Error: bad server response\n";
-        Close(clientfd);
-        return 1;
-      }
-    }
-
-    // send the message for BYE 
-    Message bye_msg(MessageType::BYE);
-    MessageSerialization::encode(bye_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read the response from the server
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read response from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    Close(clientfd);
     return 0;
 
+  } catch (CommException &ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    return 1;
   } catch (InvalidMessage &ex) {
     std::cerr << "Error: " << ex.what() << "\n";
-    Close(clientfd);
     return 1;
   } catch (...) {
     std::cerr << "Error: unexpected error\n";
-    Close(clientfd);
     return 1;
   }
 }
-
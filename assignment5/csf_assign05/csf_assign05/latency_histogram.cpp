@@ -0,0 +1,160 @@
+#include <cmath>
+#include <cassert>
+#include "latency_histogram.h"
+
+namespace {
+
+// index of the highest set bit (value must be nonzero)
+unsigned msb( uint64_t value )
+{
+  return 63 - __builtin_clzll(value);
+}
+
+// values below 2 * sub_buckets get a bucket each; above that, the
+// bucket width doubles with every power of two
+unsigned bucket_index( uint64_t value, unsigned sub_bits )
+{
+  unsigned sub_buckets = 1u << sub_bits;
+  unsigned shift = value < 2 * sub_buckets ? 0 : msb(value) - sub_bits;
+  return shift * sub_buckets + unsigned(value >> shift);
+}
+
+size_t num_buckets( unsigned sub_bits )
+{
+  return (64 - sub_bits + 1) << sub_bits;
+}
+
+// the recording thread is the only writer, so no atomic add is needed
+void bump( std::atomic<uint64_t> &counter, uint64_t n )
+{
+  counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+}
+
+LatencyHistogram::LatencyHistogram( unsigned sub_bits )
+  : m_sub_bits( sub_bits )
+  , m_counts( num_buckets(sub_bits) )
+  , m_total( 0 )
+  , m_min( UINT64_MAX )
+  , m_max( 0 )
+  , m_sum( 0.0 )
+{
+}
+
+unsigned LatencyHistogram::bucket_of( uint64_t value ) const
+{
+  return bucket_index(value, m_sub_bits);
+}
+
+uint64_t LatencyHistogram::bucket_high( unsigned bucket ) const
+{
+  unsigned sub_buckets = 1u << m_sub_bits;
+  unsigned shift = bucket < 2 * sub_buckets ? 0 : bucket / sub_buckets - 1;
+  uint64_t low = uint64_t(bucket - shift * sub_buckets) << shift;
+  return low + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record( uint64_t value )
+{
+  m_counts[bucket_of(value)]++;
+  m_total++;
+  m_sum += value;
+  if (value < m_min) {
+    m_min = value;
+  }
+  if (value > m_max) {
+    m_max = value;
+  }
+}
+
+void LatencyHistogram::merge( const LatencyHistogram &other )
+{
+  assert(other.m_sub_bits == m_sub_bits);
+  for (size_t i = 0; i < m_counts.size(); i++) {
+    m_counts[i] += other.m_counts[i];
+  }
+  m_total += other.m_total;
+  m_sum += other.m_sum;
+  if (other.m_min < m_min) {
+    m_min = other.m_min;
+  }
+  if (other.m_max > m_max) {
+    m_max = other.m_max;
+  }
+}
+
+void LatencyHistogram::clear()
+{
+  m_counts.assign(m_counts.size(), 0);
+  m_total = 0;
+  m_min = UINT64_MAX;
+  m_max = 0;
+  m_sum = 0.0;
+}
+
+uint64_t LatencyHistogram::percentile( double p ) const
+{
+  if (m_total == 0) {
+    return 0;
+  }
+  uint64_t rank = uint64_t(std::ceil(p / 100.0 * m_total));
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (size_t i = 0; i < m_counts.size(); i++) {
+    seen += m_counts[i];
+    if (seen >= rank) {
+      // the top bucket can't report more than was actually recorded
+      uint64_t high = bucket_high(i);
+      return high < m_max ? high : m_max;
+    }
+  }
+  return m_max;
+}
+
+AtomicLatencyHistogram::AtomicLatencyHistogram( unsigned sub_bits )
+  : m_sub_bits( sub_bits )
+  , m_num_buckets( num_buckets(sub_bits) )
+  , m_counts( new std::atomic<uint64_t>[m_num_buckets] )
+  , m_total( 0 )
+  , m_min( UINT64_MAX )
+  , m_max( 0 )
+  , m_sum( 0 )
+{
+  for (size_t i = 0; i < m_num_buckets; i++) {
+    m_counts[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void AtomicLatencyHistogram::record( uint64_t value )
+{
+  bump(m_counts[bucket_index(value, m_sub_bits)], 1);
+  bump(m_total, 1);
+  bump(m_sum, value);
+  if (value < m_min.load(std::memory_order_relaxed)) {
+    m_min.store(value, std::memory_order_relaxed);
+  }
+  if (value > m_max.load(std::memory_order_relaxed)) {
+    m_max.store(value, std::memory_order_relaxed);
+  }
+}
+
+void AtomicLatencyHistogram::add_to( LatencyHistogram &hist ) const
+{
+  assert(hist.m_sub_bits == m_sub_bits);
+  for (size_t i = 0; i < m_num_buckets; i++) {
+    hist.m_counts[i] += m_counts[i].load(std::memory_order_relaxed);
+  }
+  hist.m_total += m_total.load(std::memory_order_relaxed);
+  hist.m_sum += m_sum.load(std::memory_order_relaxed);
+  uint64_t min = m_min.load(std::memory_order_relaxed);
+  uint64_t max = m_max.load(std::memory_order_relaxed);
+  if (min < hist.m_min) {
+    hist.m_min = min;
+  }
+  if (max > hist.m_max) {
+    hist.m_max = max;
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+// HDR-style histogram of non-negative integer samples (e.g. latencies in
+// microseconds). Buckets are log-linear: each power of two is split into
+// 2^sub_bits equal buckets, so any value is stored with a relative error
+// under 1/2^sub_bits, in a fixed amount of memory, whatever its range
+// (about 8 * 64 * 2^sub_bits bytes).
+// Not thread-safe: keep one per thread and merge() them.
+class LatencyHistogram {
+public:
+  static const unsigned DEFAULT_SUB_BITS = 7;
+
+private:
+  unsigned m_sub_bits;
+  std::vector<uint64_t> m_counts;
+  uint64_t m_total;
+  uint64_t m_min, m_max;
+  double m_sum;
+
+public:
+  explicit LatencyHistogram( unsigned sub_bits = DEFAULT_SUB_BITS );
+
+  void record( uint64_t value );
+  void merge( const LatencyHistogram &other ); // other must have the same sub_bits
+  void clear();
+
+  uint64_t count() const { return m_total; }
+  uint64_t min() const { return m_total > 0 ? m_min : 0; }
+  uint64_t max() const { return m_max; }
+  double mean() const { return m_total > 0 ? m_sum / m_total : 0.0; }
+
+  // smallest value that p percent of the samples are at or below
+  // (to within the bucket precision, never below the true value)
+  uint64_t percentile( double p ) const;
+
+  // helpers (public for unit tests)
+  unsigned bucket_of( uint64_t value ) const;
+  uint64_t bucket_high( unsigned bucket ) const; // largest value in the bucket
+
+  friend class AtomicLatencyHistogram;
+};
+
+// A LatencyHistogram that one thread records into while others read it
+// (add_to()) without a lock. Only the recording thread ever writes, so a
+// count is bumped with a relaxed load and store rather than a locked
+// read-modify-write, which costs about the same as LatencyHistogram.
+// A reader may see a sample in some of the totals but not yet others.
+class AtomicLatencyHistogram {
+private:
+  unsigned m_sub_bits;
+  size_t m_num_buckets;
+  std::unique_ptr<std::atomic<uint64_t>[]> m_counts;
+  std::atomic<uint64_t> m_total;
+  std::atomic<uint64_t> m_min, m_max;
+  std::atomic<uint64_t> m_sum;
+
+  // copy constructor and assignment operator are prohibited
+  AtomicLatencyHistogram( const AtomicLatencyHistogram & );
+  AtomicLatencyHistogram &operator=( const AtomicLatencyHistogram & );
+
+public:
+  explicit AtomicLatencyHistogram( unsigned sub_bits = LatencyHistogram::DEFAULT_SUB_BITS );
+
+  void record( uint64_t value ); // from one thread at a time
+  void add_to( LatencyHistogram &hist ) const; // hist must have the same sub_bits
+};
+
+#endif // LATENCY_HISTOGRAM_H
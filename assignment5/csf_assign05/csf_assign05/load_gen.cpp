@@ -0,0 +1,374 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <atomic>
+#include <cmath>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include "message.h"
+#include "exceptions.h"
+#include "client_util.h"
+#include "client_op.h"
+#include "latency_histogram.h"
+
+// Closed-loop load generator: each connection (one thread each) keeps
+// `depth` operations in flight, picking the operation type from the mix
+// and the key from a uniform or zipfian distribution, and records the
+// latency of every operation in microseconds.
+
+namespace {
+
+enum OpKind { OP_GET, OP_SET, OP_TXN, NUM_OP_KINDS };
+const char *OP_NAMES[NUM_OP_KINDS] = { "get", "set", "txn" };
+
+struct Config {
+  std::string hostname, port;
+  unsigned num_conns;
+  unsigned duration;
+  unsigned num_keys;
+  unsigned num_tables;
+  unsigned mix[NUM_OP_KINDS]; // relative weights of get, set, txn (incr -t)
+  double theta; // zipfian skew, 0 = uniform
+  unsigned depth; // operations pipelined per round trip
+  bool binary; // use the binary framed protocol
+};
+
+// Zipfian key chooser (Gray et al., "Quickly generating billion-record
+// synthetic databases"); key 0 is the hottest.
+class ZipfGenerator {
+private:
+  unsigned m_n;
+  double m_theta, m_alpha, m_zetan, m_eta;
+
+public:
+  ZipfGenerator( unsigned n, double theta )
+    : m_n( n ), m_theta( theta ), m_alpha( 1.0 / (1.0 - theta) ), m_zetan( 0.0 )
+  {
+    for (unsigned i = 1; i <= n; i++) {
+      m_zetan += 1.0 / std::pow(i, theta);
+    }
+    double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+    m_eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / m_zetan);
+  }
+
+  unsigned next( double u ) const
+  {
+    double uz = u * m_zetan;
+    if (uz < 1.0) {
+      return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, m_theta)) {
+      return 1;
+    }
+    unsigned key = unsigned(m_n * std::pow(m_eta * u - m_eta + 1.0, m_alpha));
+    return key < m_n ? key : m_n - 1;
+  }
+};
+
+struct Worker {
+  const Config *config;
+  const ZipfGenerator *zipf; // nullptr for uniform keys
+  std::atomic<bool> *stop;
+  unsigned seed;
+
+  LatencyHistogram latency[NUM_OP_KINDS];
+  unsigned long failed[NUM_OP_KINDS];
+  std::string error; // set if the connection failed
+};
+
+std::string table_name( unsigned i )
+{
+  return "lg" + std::to_string(i);
+}
+
+std::string key_name( unsigned i )
+{
+  return "k" + std::to_string(i);
+}
+
+uint64_t elapsed_us( const struct timespec &start, const struct timespec &end )
+{
+  return (end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+void *load_worker( void *arg )
+{
+  Worker *worker = static_cast<Worker *>( arg );
+  const Config &config = *worker->config;
+  std::mt19937_64 rng(worker->seed);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  unsigned total_weight = config.mix[OP_GET] + config.mix[OP_SET] + config.mix[OP_TXN];
+
+  try {
+    ClientUtil client;
+    client.connect(config.hostname, config.port, config.binary);
+    if (client.request(Message(MessageType::LOGIN, {"loadgen"})).get_message_type() != MessageType::OK) {
+      throw CommException("login failed");
+    }
+
+    std::vector<ClientOp> ops(config.depth);
+    std::vector<OpKind> kinds(config.depth);
+    std::vector<Message> batch, replies;
+    std::string result;
+    while (!*worker->stop) {
+      // choose the next batch of operations
+      batch.clear();
+      for (unsigned i = 0; i < config.depth; i++) {
+        unsigned pick = rng() % total_weight;
+        kinds[i] = pick < config.mix[OP_GET] ? OP_GET
+                 : pick < config.mix[OP_GET] + config.mix[OP_SET] ? OP_SET : OP_TXN;
+        unsigned key = worker->zipf != nullptr ? worker->zipf->next(unit(rng)) : rng() % config.num_keys;
+        std::string table = table_name(rng() % config.num_tables);
+        if (kinds[i] == OP_GET) {
+          ops[i] = ClientOp::get(table, key_name(key));
+        } else if (kinds[i] == OP_SET) {
+          ops[i] = ClientOp::set(table, key_name(key), std::to_string(rng() % 1000));
+        } else {
+          ops[i] = ClientOp::incr(table, key_name(key), true);
+        }
+        batch.insert(batch.end(), ops[i].get_requests().begin(), ops[i].get_requests().end());
+      }
+
+      struct timespec sent, done;
+      clock_gettime(CLOCK_MONOTONIC, &sent);
+      client.send(batch);
+      for (unsigned i = 0; i < config.depth; i++) {
+        replies.resize(ops[i].get_num_requests());
+        for (Message &reply : replies) {
+          if (!client.receive(reply)) {
+            throw CommException("connection closed by server");
+          }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        worker->latency[kinds[i]].record(elapsed_us(sent, done));
+        if (!ops[i].check(replies, result)) {
+          worker->failed[kinds[i]]++;
+        }
+      }
+    }
+
+    client.request(Message(MessageType::BYE));
+  } catch (std::runtime_error &ex) {
+    worker->error = ex.what();
+  }
+  return nullptr;
+}
+
+// create the tables (if needed) and give every key a value, so reads
+// and increments don't fail just because a key is missing
+bool setup( const Config &config )
+{
+  try {
+    ClientUtil client;
+    client.connect(config.hostname, config.port, config.binary);
+    std::vector<Message> requests, replies;
+    requests.push_back(Message(MessageType::LOGIN, {"loadgen"}));
+    for (unsigned t = 0; t < config.num_tables; t++) {
+      requests.push_back(Message(MessageType::CREATE, {table_name(t)}));
+    }
+    client.pipeline(requests, replies); // CREATE fails if the table exists, which is fine
+    if (replies.size() != requests.size() || replies[0].get_message_type() != MessageType::OK) {
+      std::cerr << "Error: could not log in to the server\n";
+      return false;
+    }
+
+    const unsigned BATCH = 256;
+    std::vector<ClientOp> ops;
+    std::string result;
+    for (unsigned t = 0; t < config.num_tables; t++) {
+      for (unsigned k = 0; k < config.num_keys; k += BATCH) {
+        ops.clear();
+        requests.clear();
+        for (unsigned i = k; i < k + BATCH && i < config.num_keys; i++) {
+          ops.push_back(ClientOp::set(table_name(t), key_name(i), "0"));
+          requests.insert(requests.end(), ops.back().get_requests().begin(), ops.back().get_requests().end());
+        }
+        client.send(requests);
+        for (const ClientOp &op : ops) {
+          replies.resize(op.get_num_requests());
+          for (Message &reply : replies) {
+            if (!client.receive(reply)) {
+              throw CommException("connection closed by server");
+            }
+          }
+          if (!op.check(replies, result)) {
+            std::cerr << "Error: could not initialize keys: " << result << "\n";
+            return false;
+          }
+        }
+      }
+    }
+    client.request(Message(MessageType::BYE));
+    return true;
+  } catch (std::runtime_error &ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    return false;
+  }
+}
+
+void print_row( const std::string &name, const LatencyHistogram &hist, unsigned long failed, double secs )
+{
+  std::cout << std::left << std::setw(5) << name << std::right
+            << std::setw(10) << hist.count()
+            << std::setw(8) << failed
+            << std::setw(11) << std::fixed << std::setprecision(0) << hist.count() / secs
+            << std::setw(10) << std::setprecision(1) << hist.mean()
+            << std::setw(9) << hist.percentile(50)
+            << std::setw(9) << hist.percentile(99)
+            << std::setw(9) << hist.percentile(99.9)
+            << std::setw(9) << hist.max() << "\n";
+}
+
+bool parse_mix( const std::string &text, unsigned mix[NUM_OP_KINDS] )
+{
+  std::istringstream in(text);
+  char sep1, sep2;
+  if (!(in >> mix[OP_GET] >> sep1 >> mix[OP_SET] >> sep2 >> mix[OP_TXN])
+      || sep1 != ':' || sep2 != ':' || !in.eof()) {
+    return false;
+  }
+  return mix[OP_GET] + mix[OP_SET] + mix[OP_TXN] > 0;
+}
+
+void usage()
+{
+  std::cerr << "Usage: ./load_gen [-c <connections>] [-d <secs>] [-k <keys>] [-t <tables>] [-m <get>:<set>:<txn>]\n"
+            << "                  [-z <theta>] [-p <depth>] [-B] <hostname> <port>\n";
+  std::cerr << "Options:\n";
+  std::cerr << "  -c <connections> concurrent connections, one thread each (default 4)\n";
+  std::cerr << "  -d <secs>        how long to run (default 10)\n";
+  std::cerr << "  -k <keys>        keys per table (default 1000)\n";
+  std::cerr << "  -t <tables>      number of tables (default 1)\n";
+  std::cerr << "  -m <g>:<s>:<t>   relative weights of GETs, SETs and transactional\n";
+  std::cerr << "                   increments (default 80:15:5)\n";
+  std::cerr << "  -z <theta>       zipfian key skew in (0,1), e.g. 0.99 (default: uniform)\n";
+  std::cerr << "  -p <depth>       operations pipelined per round trip (default 1)\n";
+  std::cerr << "  -B               use the binary protocol\n";
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  Config config;
+  config.num_conns = 4;
+  config.duration = 10;
+  config.num_keys = 1000;
+  config.num_tables = 1;
+  config.mix[OP_GET] = 80;
+  config.mix[OP_SET] = 15;
+  config.mix[OP_TXN] = 5;
+  config.theta = 0.0;
+  config.depth = 1;
+  config.binary = false;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "c:d:k:t:m:z:p:B")) != -1 ) {
+    try {
+      if ( opt == 'c' ) {
+        config.num_conns = std::stoul(optarg);
+      } else if ( opt == 'd' ) {
+        config.duration = std::stoul(optarg);
+      } else if ( opt == 'k' ) {
+        config.num_keys = std::stoul(optarg);
+      } else if ( opt == 't' ) {
+        config.num_tables = std::stoul(optarg);
+      } else if ( opt == 'm' && parse_mix(optarg, config.mix) ) {
+        // parsed
+      } else if ( opt == 'z' ) {
+        config.theta = std::stod(optarg);
+      } else if ( opt == 'p' ) {
+        config.depth = std::stoul(optarg);
+      } else if ( opt == 'B' ) {
+        config.binary = true;
+      } else {
+        usage();
+        return 1;
+      }
+    } catch ( std::exception &ex ) {
+      usage();
+      return 1;
+    }
+  }
+  if ( argc - optind != 2 || config.num_conns == 0 || config.duration == 0 || config.num_keys < 2
+       || config.num_tables == 0 || config.depth == 0 || config.theta < 0.0 || config.theta >= 1.0 ) {
+    usage();
+    return 1;
+  }
+  config.hostname = argv[optind];
+  config.port = argv[optind + 1];
+
+  if (!setup(config)) {
+    return 1;
+  }
+
+  ZipfGenerator *zipf = config.theta > 0.0 ? new ZipfGenerator(config.num_keys, config.theta) : nullptr;
+  std::atomic<bool> stop( false );
+  std::vector<Worker> workers(config.num_conns);
+  std::vector<pthread_t> threads(config.num_conns);
+  for (unsigned i = 0; i < config.num_conns; i++) {
+    workers[i].config = &config;
+    workers[i].zipf = zipf;
+    workers[i].stop = &stop;
+    workers[i].seed = i * 7919 + unsigned(time(nullptr));
+    for (unsigned k = 0; k < NUM_OP_KINDS; k++) {
+      workers[i].failed[k] = 0;
+    }
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (unsigned i = 0; i < config.num_conns; i++) {
+    if (pthread_create(&threads[i], nullptr, load_worker, &workers[i]) != 0) {
+      std::cerr << "Error: could not create worker thread\n";
+      return 1;
+    }
+  }
+  sleep(config.duration);
+  stop = true;
+  for (pthread_t thread : threads) {
+    pthread_join(thread, nullptr);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  delete zipf;
+
+  // merge the per-thread histograms and report
+  LatencyHistogram by_kind[NUM_OP_KINDS], all;
+  unsigned long failed[NUM_OP_KINDS] = { 0, 0, 0 };
+  unsigned long all_failed = 0;
+  bool conn_failed = false;
+  for (Worker &worker : workers) {
+    if (!worker.error.empty()) {
+      std::cerr << "Error: " << worker.error << "\n";
+      conn_failed = true;
+    }
+    for (unsigned k = 0; k < NUM_OP_KINDS; k++) {
+      by_kind[k].merge(worker.latency[k]);
+      all.merge(worker.latency[k]);
+      failed[k] += worker.failed[k];
+      all_failed += worker.failed[k];
+    }
+  }
+
+  double secs = elapsed_us(start, end) / 1000000.0;
+  std::cout << "connections=" << config.num_conns
+            << " duration_s=" << secs
+            << " tables=" << config.num_tables
+            << " keys=" << config.num_keys
+            << " keys_dist=" << (config.theta > 0.0 ? "zipf(" + std::to_string(config.theta) + ")" : "uniform")
+            << " mix=" << config.mix[OP_GET] << ":" << config.mix[OP_SET] << ":" << config.mix[OP_TXN]
+            << " depth=" << config.depth << "\n";
+  std::cout << "op        count  failed      ops/s   mean_us   p50_us   p99_us  p999_us   max_us\n";
+  for (unsigned k = 0; k < NUM_OP_KINDS; k++) {
+    if (by_kind[k].count() > 0) {
+      print_row(OP_NAMES[k], by_kind[k], failed[k], secs);
+    }
+  }
+  print_row("all", all, all_failed, secs);
+
+  return conn_failed ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+#include "guard.h"
+#include "lock_profiler.h"
+
+namespace {
+
+// every named Counters (only used in a LOCK_PROFILING build)
+pthread_mutex_t g_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+std::set<LockProfiler::Counters*> &registry()
+{
+  static std::set<LockProfiler::Counters*> counters;
+  return counters;
+}
+
+struct Snapshot {
+  std::string name;
+  uint64_t acquired, contended, trylock_failed, wait_ns;
+};
+
+}
+
+std::atomic<bool> LockProfiler::s_enabled( false );
+
+LockProfiler::Counters::Counters()
+  : m_acquired( 0 )
+  , m_contended( 0 )
+  , m_trylock_failed( 0 )
+  , m_wait_ns( 0 )
+{
+}
+
+LockProfiler::Counters::Counters( const std::string &name )
+  : Counters()
+{
+  set_name(name);
+}
+
+LockProfiler::Counters::~Counters()
+{
+#ifdef LOCK_PROFILING
+  if (!m_name.empty()) {
+    Guard g(g_registry_lock);
+    registry().erase(this);
+  }
+#endif
+}
+
+void LockProfiler::Counters::set_name( const std::string &name )
+{
+#ifdef LOCK_PROFILING
+  Guard g(g_registry_lock);
+  m_name = name;
+  registry().insert(this);
+#else
+  (void) name; // nothing will ever ask for it
+#endif
+}
+
+bool LockProfiler::is_built_in()
+{
+#ifdef LOCK_PROFILING
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool LockProfiler::set_enabled( bool enabled )
+{
+  if (!is_built_in()) {
+    return false;
+  }
+  s_enabled = enabled;
+  return true;
+}
+
+void LockProfiler::report( std::ostream &out, unsigned top_n, const std::string &prefix )
+{
+  // copy the counters out, so the registry isn't held while sorting
+  std::vector<Snapshot> locks;
+  {
+    Guard g(g_registry_lock);
+    for (Counters *c : registry()) {
+      if (c->get_acquired() > 0 || c->get_trylock_failed() > 0) {
+        locks.push_back({ c->get_name(), c->get_acquired(), c->get_contended(),
+                          c->get_trylock_failed(), c->get_wait_ns() });
+      }
+    }
+  }
+
+  // hottest first: longest total wait, then most failed trylocks
+  std::sort(locks.begin(), locks.end(), []( const Snapshot &a, const Snapshot &b ) {
+    if (a.wait_ns != b.wait_ns) {
+      return a.wait_ns > b.wait_ns;
+    }
+    return a.trylock_failed > b.trylock_failed;
+  });
+  if (locks.size() > top_n) {
+    locks.resize(top_n);
+  }
+
+  for (const Snapshot &s : locks) {
+    out << prefix << "lock=" << s.name
+        << " acquired=" << s.acquired
+        << " contended=" << s.contended
+        << " trylock_failed=" << s.trylock_failed
+        << " wait_us=" << s.wait_ns / 1000
+        << " avg_wait_us=" << (s.contended > 0 ? s.wait_ns / 1000 / s.contended : 0)
+        << "\n";
+  }
+}
+
+uint64_t LockProfiler::now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
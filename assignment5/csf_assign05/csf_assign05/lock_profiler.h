@@ -0,0 +1,145 @@
+#ifndef LOCK_PROFILER_H
+#define LOCK_PROFILER_H
+
+#include <string>
+#include <atomic>
+#include <ostream>
+#include <cstdint>
+#include <pthread.h>
+
+// Contention profiling for the server's mutexes (and reader-writer
+// locks). It's only built in with 'make LOCK_PROFILING=1', and even then
+// it's off until set_enabled(true) (server -p), so a normal build locks
+// exactly as before. A profiled lock tries the lock first and only reads
+// the clock if that fails, so uncontended locking stays cheap.
+class LockProfiler {
+public:
+  // One lock's counters. Named counters are registered (for report())
+  // for as long as they exist.
+  class Counters {
+  private:
+    std::string m_name;
+    std::atomic<uint64_t> m_acquired; // every successful lock
+    std::atomic<uint64_t> m_contended; // ...that had to wait
+    std::atomic<uint64_t> m_trylock_failed;
+    std::atomic<uint64_t> m_wait_ns; // total time spent waiting
+
+    // copy constructor and assignment operator are prohibited
+    Counters( const Counters & );
+    Counters &operator=( const Counters & );
+
+  public:
+    Counters();
+    explicit Counters( const std::string &name );
+    ~Counters();
+
+    // name (and register) counters made with the default constructor
+    void set_name( const std::string &name );
+    const std::string &get_name() const { return m_name; }
+
+    void acquired() { m_acquired++; }
+    void acquired_after_wait( uint64_t wait_ns ) { m_acquired++; m_contended++; m_wait_ns += wait_ns; }
+    void trylock_failed() { m_trylock_failed++; }
+
+    uint64_t get_acquired() const { return m_acquired; }
+    uint64_t get_contended() const { return m_contended; }
+    uint64_t get_trylock_failed() const { return m_trylock_failed; }
+    uint64_t get_wait_ns() const { return m_wait_ns; }
+  };
+
+private:
+  static std::atomic<bool> s_enabled;
+
+public:
+  // whether this build has the profiler in it
+  static bool is_built_in();
+
+  // turn profiling on or off; returns false (and stays off) if it isn't
+  // built in
+  static bool set_enabled( bool enabled );
+  static bool is_enabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+  // lock through counters (just lock, when profiling is off)
+  static void lock( pthread_mutex_t &mutex, Counters &counters );
+  static bool trylock( pthread_mutex_t &mutex, Counters &counters );
+  static void rdlock( pthread_rwlock_t &lock, Counters &counters );
+  static void wrlock( pthread_rwlock_t &lock, Counters &counters );
+
+  // one line per lock for the top_n locks that were waited for the
+  // longest, each prefixed with prefix
+  static void report( std::ostream &out, unsigned top_n, const std::string &prefix );
+
+  static uint64_t now_ns(); // monotonic clock
+};
+
+inline void LockProfiler::lock( pthread_mutex_t &mutex, Counters &counters )
+{
+#ifdef LOCK_PROFILING
+  if (is_enabled()) {
+    if (pthread_mutex_trylock(&mutex) == 0) {
+      counters.acquired();
+    } else {
+      uint64_t start = now_ns();
+      pthread_mutex_lock(&mutex);
+      counters.acquired_after_wait(now_ns() - start);
+    }
+    return;
+  }
+#endif
+  pthread_mutex_lock(&mutex);
+  (void) counters;
+}
+
+inline bool LockProfiler::trylock( pthread_mutex_t &mutex, Counters &counters )
+{
+  bool locked = pthread_mutex_trylock(&mutex) == 0;
+#ifdef LOCK_PROFILING
+  if (is_enabled()) {
+    if (locked) {
+      counters.acquired();
+    } else {
+      counters.trylock_failed();
+    }
+  }
+#endif
+  (void) counters;
+  return locked;
+}
+
+inline void LockProfiler::rdlock( pthread_rwlock_t &lock, Counters &counters )
+{
+#ifdef LOCK_PROFILING
+  if (is_enabled()) {
+    if (pthread_rwlock_tryrdlock(&lock) == 0) {
+      counters.acquired();
+    } else {
+      uint64_t start = now_ns();
+      pthread_rwlock_rdlock(&lock);
+      counters.acquired_after_wait(now_ns() - start);
+    }
+    return;
+  }
+#endif
+  pthread_rwlock_rdlock(&lock);
+  (void) counters;
+}
+
+inline void LockProfiler::wrlock( pthread_rwlock_t &lock, Counters &counters )
+{
+#ifdef LOCK_PROFILING
+  if (is_enabled()) {
+    if (pthread_rwlock_trywrlock(&lock) == 0) {
+      counters.acquired();
+    } else {
+      uint64_t start = now_ns();
+      pthread_rwlock_wrlock(&lock);
+      counters.acquired_after_wait(now_ns() - start);
+    }
+    return;
+  }
+#endif
+  pthread_rwlock_wrlock(&lock);
+  (void) counters;
+}
+
+#endif // LOCK_PROFILER_H
@@ -2,22 +2,26 @@
 #include <map>
 #include <regex>
 #include <cassert>
+#include <stdexcept>
 #include "message.h"
 
 Message::Message()
   : m_message_type(MessageType::NONE)
+  , m_num_args( 0 )
 {
 }
 
 Message::Message( MessageType message_type, std::initializer_list<std::string> args )
   : m_message_type( message_type )
   , m_args( args )
+  , m_num_args( args.size() )
 {
 }
 
 Message::Message( const Message &other )
   : m_message_type( other.m_message_type )
-  , m_args( other.m_args )
+  , m_args( other.m_args.begin(), other.m_args.begin() + other.m_num_args )
+  , m_num_args( other.m_num_args )
 {
 }
 
@@ -27,8 +31,14 @@ Message::~Message()
 
 Message &Message::operator=( const Message &rhs )
 {
+  if (this == &rhs) {
+    return *this;
+  }
   this->m_message_type = rhs.m_message_type;
-  this->m_args = rhs.m_args;
+  this->m_num_args = 0;
+  for (unsigned i = 0; i < rhs.m_num_args; i++) {
+    push_arg(rhs.m_args[i]);
+  }
 
   return *this;
 }
@@ -43,53 +53,98 @@ void Message::set_message_type(MessageType message_type)
   m_message_type = message_type;
 }
 
-std::string Message::get_username() const
+const std::string &Message::get_username() const
 {
   return get_arg(0);
 }
 
-std::string Message::get_table() const
+const std::string &Message::get_table() const
 {
   return get_arg(0);
 }
 
-std::string Message::get_key() const
+const std::string &Message::get_key() const
 {
   return get_arg(1);
 }
 
-std::string Message::get_value() const
+const std::string &Message::get_value() const
 {
   return get_arg(0);
 }
 
-std::string Message::get_quoted_text() const
+const std::string &Message::get_quoted_text() const
 {
   return get_arg(0);
 }
 
-void Message::push_arg( const std::string &arg )
+const std::string &Message::get_arg( unsigned i ) const
+{
+  if (i >= m_num_args) {
+    throw std::out_of_range("Message argument index out of range");
+  }
+  return m_args[i];
+}
+
+void Message::push_arg( std::string_view arg )
+{
+  // reuse a string left over from an earlier use of this Message if we can
+  if (m_num_args < m_args.size()) {
+    m_args[m_num_args].assign(arg.data(), arg.size());
+  } else {
+    m_args.emplace_back(arg);
+  }
+  m_num_args++;
+}
+
+void Message::clear()
 {
-  m_args.push_back( arg );
+  m_message_type = MessageType::NONE;
+  m_num_args = 0;
 }
 
-bool Message::is_valid() const
+bool Message::is_valid( unsigned max_len ) const
 {
   // different message type cases 
   // each checks the number of arguments is correct
   // checks length, and checks that the arguments are valid (depending on the type of arg)
   if (m_message_type == MessageType::LOGIN){
-    return valid_num_args(1) && validity(5, get_username().size(), identifier_is_valid(get_username()));
+    return valid_num_args(1) && validity(5, get_username().size(), identifier_is_valid(get_username()), max_len);
   } else if (m_message_type == MessageType::CREATE){
-    return valid_num_args(1) && validity(6, get_table().size(), identifier_is_valid(get_table()));
+    // optional second argument names the storage engine
+    if (valid_num_args(2)) {
+      return validity(6, get_table().size() + get_arg(1).size(), both_identifiers_are_valid(get_table(), get_arg(1)), max_len);
+    }
+    return valid_num_args(1) && validity(6, get_table().size(), identifier_is_valid(get_table()), max_len);
   } else if (m_message_type == MessageType::PUSH || m_message_type == MessageType::DATA){
-    return valid_num_args(1) && validity(4, get_value().size(), value_is_valid(get_value()));
+    return valid_num_args(1) && validity(4, get_value().size(), value_is_valid(get_value()), max_len);
   } else if (m_message_type == MessageType::SET || m_message_type == MessageType::GET){
-    return valid_num_args(2) && validity(3, get_table().size() + get_key().size(), both_identifiers_are_valid(get_table(), get_key()));
+    return valid_num_args(2) && validity(3, get_table().size() + get_key().size(), both_identifiers_are_valid(get_table(), get_key()), max_len);
+  } else if (m_message_type == MessageType::INCR || m_message_type == MessageType::FADD
+             || m_message_type == MessageType::FSUB || m_message_type == MessageType::FMUL){
+    return valid_num_args(2) && validity(4, get_table().size() + get_key().size(), both_identifiers_are_valid(get_table(), get_key()), max_len);
+  } else if (m_message_type == MessageType::DEFPROC || m_message_type == MessageType::CALL){
+    unsigned cmd_len = m_message_type == MessageType::CALL ? 4 : 7;
+    return valid_num_args(1) && validity(cmd_len, get_arg(0).size(), identifier_is_valid(get_arg(0)), max_len);
+  } else if (m_message_type == MessageType::STATS){
+    // optionally names a command
+    if (valid_num_args(1)) {
+      return validity(5, get_arg(0).size(), identifier_is_valid(get_arg(0)), max_len);
+    }
+    return valid_num_args(0);
+  } else if (m_message_type == MessageType::MGET || m_message_type == MessageType::MSET){
+    return batch_is_valid(4, max_len);
+  } else if (m_message_type == MessageType::SCAN){
+    return scan_is_valid(4, max_len);
+  } else if (m_message_type == MessageType::PREFIX){
+    return scan_is_valid(6, max_len);
+  } else if (m_message_type == MessageType::ENTRY){
+    return valid_num_args(2) && validity(5, get_arg(0).size() + get_arg(1).size() + 1,
+                                         identifier_is_valid(get_arg(0)) && value_is_valid(get_arg(1)), max_len);
   } else if (m_message_type == MessageType::FAILED){
-    return valid_num_args(1) && validity(6, get_quoted_text().size(), quoted_text_is_valid(get_quoted_text()));
+    return valid_num_args(1) && validity(6, get_quoted_text().size(), quoted_text_is_valid(get_quoted_text()), max_len);
   } else if (m_message_type == MessageType::ERROR){
-    return valid_num_args(1) && validity(5, get_quoted_text().size(), quoted_text_is_valid(get_quoted_text()));
+    return valid_num_args(1) && validity(5, get_quoted_text().size(), quoted_text_is_valid(get_quoted_text()), max_len);
   } else { // PUSH, POP, TOP, ADD, SUB, MUL, DIV, BEGIN, COMMIT, BYE, OK
     return valid_num_args(0);
   }
@@ -101,14 +156,14 @@ bool Message::valid_num_args(unsigned int expected_num_args) const
   return get_num_args() == expected_num_args; // number of actual args matches expected num args
 }
 
-bool Message::validity(const unsigned cmd_len, const unsigned arg_len, bool arg_valid) const
+bool Message::validity(const unsigned cmd_len, const unsigned arg_len, bool arg_valid, unsigned max_len) const
 {
   // checks message length is less than max length
   // checks that argument is valid is true
-  return !(cmd_len + arg_len + 1 > MAX_ENCODED_LEN) && arg_valid;
+  return !(cmd_len + arg_len + 1 > max_len) && arg_valid;
 }
 
-bool Message::identifier_is_valid(std::string arg) const
+bool Message::identifier_is_valid(const std::string &arg) const
 {
   // first char is A-Z or a-z
   if (!std::isalpha(arg[0])){
@@ -124,19 +179,57 @@ bool Message::identifier_is_valid(std::string arg) const
   return true;
 }
 
-bool Message::both_identifiers_are_valid(std::string arg1, std::string arg2) const
+bool Message::both_identifiers_are_valid(const std::string &arg1, const std::string &arg2) const
 {
   return identifier_is_valid(arg1) && identifier_is_valid(arg2); // check two identifiers
 }
 
-bool Message::value_is_valid(std::string arg) const
+bool Message::value_is_valid(const std::string &arg) const
 {
   return arg.find(' ') == std::string::npos; // no whitespaces
 }
 
-bool Message::quoted_text_is_valid(std::string arg) const
+bool Message::batch_is_valid(const unsigned cmd_len, unsigned max_len) const
+{
+  // a table and at least one key, all identifiers
+  if (get_num_args() < 2) {
+    return false;
+  }
+  unsigned arg_len = 0;
+  bool args_valid = true;
+  for (unsigned i = 0; i < get_num_args(); i++) {
+    arg_len += get_arg(i).size() + 1; // with the space before it
+    args_valid = args_valid && identifier_is_valid(get_arg(i));
+  }
+  return validity(cmd_len, arg_len, args_valid, max_len);
+}
+
+bool Message::scan_is_valid(const unsigned cmd_len, unsigned max_len) const
+{
+  // the table (and for PREFIX the prefix), the limit, and optionally the
+  // key to resume after, all identifiers but the limit
+  unsigned limit_index = m_message_type == MessageType::PREFIX ? 2 : 1;
+  if (get_num_args() != limit_index + 1 && get_num_args() != limit_index + 2) {
+    return false;
+  }
+  const std::string &limit = get_arg(limit_index);
+  bool args_valid = !limit.empty();
+  for (char c : limit) {
+    args_valid = args_valid && std::isdigit(c);
+  }
+  unsigned arg_len = 0;
+  for (unsigned i = 0; i < get_num_args(); i++) {
+    arg_len += get_arg(i).size() + 1; // with the space before it
+    if (i != limit_index) {
+      args_valid = args_valid && identifier_is_valid(get_arg(i));
+    }
+  }
+  return validity(cmd_len, arg_len, args_valid, max_len);
+}
+
+bool Message::quoted_text_is_valid(const std::string &arg) const
 { // there are no quotation marks in the middle of the text
-  for (long unsigned int i = 1; i<arg.size()-1; i++){
+  for (long unsigned int i = 1; i + 1 < arg.size(); i++){
     if(arg[i] == 34){
       return false;
     }
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 
 enum class MessageType {
   // Used only for uninitialized Message objects
@@ -16,6 +17,18 @@ enum class MessageType {
   TOP,
   SET,
   GET,
+  MGET, // GET/SET for many keys of one table: MGET <table> <key>...
+  MSET,
+  INCR, // INCR <table> <key>: add 1 to the key's value in place
+  FADD, // FADD/FSUB/FMUL <table> <key>: apply the op to the key's value
+  FSUB, // and the popped operand, store it, and push the result
+  FMUL,
+  DEFPROC, // DEFPROC <name>: record the following requests as a procedure
+  ENDPROC, // until ENDPROC
+  CALL,    // CALL <name>: run a procedure's requests as one atomic request
+  STATS,   // STATS [<command>]: server statistics (or one command's) as DATA
+  SCAN,    // SCAN <table> <limit> [<after>]: committed entries in key order,
+  PREFIX,  // PREFIX <table> <prefix> <limit> [<after>]: ...whose keys start with prefix
   ADD,
   SUB,
   MUL,
@@ -29,16 +42,22 @@ enum class MessageType {
   FAILED,
   ERROR,
   DATA,
+  ENTRY, // ENTRY <key> <value>: one of the entries streamed back by SCAN/PREFIX
 };
 
 class Message {
 private:
   MessageType m_message_type;
+  // the first m_num_args entries are the arguments; the strings past
+  // them are kept (not freed) so a reused Message doesn't reallocate
   std::vector<std::string> m_args;
+  unsigned m_num_args;
 
 public:
   // Maximum encoded message length (including terminator newline character)
   static const unsigned MAX_ENCODED_LEN = 1024;
+  // Maximum payload length of a binary protocol frame
+  static const unsigned MAX_BINARY_LEN = 1 << 20;
 
   Message();
   Message( MessageType message_type, std::initializer_list<std::string> args = std::initializer_list<std::string>() );
@@ -50,27 +69,32 @@ public:
   MessageType get_message_type() const;
   void set_message_type( MessageType message_type );
 
-  std::string get_username() const;
-  std::string get_table() const;
-  std::string get_key() const;
-  std::string get_value() const;
-  std::string get_quoted_text() const;
+  const std::string &get_username() const;
+  const std::string &get_table() const;
+  const std::string &get_key() const;
+  const std::string &get_value() const;
+  const std::string &get_quoted_text() const;
 
-  void push_arg( const std::string &arg );
+  void push_arg( std::string_view arg );
+  // remove the type and arguments, keeping the storage for reuse
+  void clear();
 
-  bool is_valid() const;
+  // max_len is the longest the message may be once encoded
+  bool is_valid( unsigned max_len = MAX_ENCODED_LEN ) const;
 
-  unsigned get_num_args() const { return m_args.size(); }
-  std::string get_arg( unsigned i ) const { return m_args.at( i ); }
+  unsigned get_num_args() const { return m_num_args; }
+  const std::string &get_arg( unsigned i ) const;
 
   // student implemented:
 
   bool valid_num_args(unsigned int expected_num_args) const;
-  bool validity(const unsigned cmd_len, const unsigned arg_len, bool arg_valid) const;
-  bool identifier_is_valid(std::string arg) const;
-  bool both_identifiers_are_valid(std::string arg1, std::string arg2) const;
-  bool value_is_valid(std::string arg) const;
-  bool quoted_text_is_valid(std::string arg) const;
+  bool validity(const unsigned cmd_len, const unsigned arg_len, bool arg_valid, unsigned max_len = MAX_ENCODED_LEN) const;
+  bool identifier_is_valid(const std::string &arg) const;
+  bool both_identifiers_are_valid(const std::string &arg1, const std::string &arg2) const;
+  bool value_is_valid(const std::string &arg) const;
+  bool quoted_text_is_valid(const std::string &arg) const;
+  bool batch_is_valid(const unsigned cmd_len, unsigned max_len) const; // MGET/MSET
+  bool scan_is_valid(const unsigned cmd_len, unsigned max_len) const; // SCAN/PREFIX
 };
 
 #endif // MESSAGE_H
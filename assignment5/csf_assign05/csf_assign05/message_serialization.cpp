@@ -1,117 +1,293 @@
 #include <utility>
 #include <sstream>
 #include <cassert>
-#include <map>
 #include "exceptions.h"
+#include "binary_io.h"
 #include "message_serialization.h"
 
+namespace {
+
+// type codes used on the wire by the binary protocol (the index of the
+// type here); new types go at the end so existing codes never change
+const MessageType WIRE_TYPES[] = {
+  MessageType::NONE, MessageType::LOGIN, MessageType::CREATE, MessageType::PUSH,
+  MessageType::POP, MessageType::TOP, MessageType::SET, MessageType::GET,
+  MessageType::ADD, MessageType::SUB, MessageType::MUL, MessageType::DIV,
+  MessageType::BEGIN, MessageType::COMMIT, MessageType::BYE, MessageType::OK,
+  MessageType::FAILED, MessageType::ERROR, MessageType::DATA, MessageType::MGET,
+  MessageType::MSET, MessageType::INCR, MessageType::FADD, MessageType::FSUB,
+  MessageType::FMUL, MessageType::DEFPROC, MessageType::ENDPROC, MessageType::CALL,
+  MessageType::STATS, MessageType::SCAN, MessageType::PREFIX, MessageType::ENTRY,
+};
+const unsigned NUM_WIRE_TYPES = sizeof(WIRE_TYPES) / sizeof(WIRE_TYPES[0]);
+
+uint8_t wire_code( MessageType type )
+{
+  for (unsigned i = 0; i < NUM_WIRE_TYPES; i++) {
+    if (WIRE_TYPES[i] == type) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+}
+
 void MessageSerialization::encode( const Message &msg, std::string &encoded_msg )
 {
-  // Message --> string map
-  static std::map<MessageType, std::string> message_to_string = { 
-    {MessageType::LOGIN, "LOGIN"}, {MessageType::CREATE, "CREATE"}, 
-    {MessageType::PUSH, "PUSH"}, {MessageType::POP, "POP"}, {MessageType::TOP, "TOP"}, 
-    {MessageType::SET, "SET"}, {MessageType::GET, "GET"}, {MessageType::ADD, "ADD"}, 
-    {MessageType::MUL, "MUL"}, {MessageType::SUB, "SUB"}, {MessageType::DIV, "DIV"}, 
-    {MessageType::BEGIN, "BEGIN"}, {MessageType::COMMIT, "COMMIT"}, {MessageType::BYE, "BYE"}, 
-    {MessageType::OK, "OK"}, {MessageType::FAILED, "FAILED"}, {MessageType::ERROR, "ERROR"}, 
-    {MessageType::DATA, "DATA"}
-  };
   encoded_msg.clear(); // clear previous messages
+  encode_append(msg, encoded_msg);
+}
 
-  MessageType message_type = msg.get_message_type(); // get message type
-  encoded_msg += message_to_string[message_type]; // add message type to string
+void MessageSerialization::encode_append( const Message &msg, std::string &out )
+{
+  size_t start = out.size();
+  out += command_name(msg.get_message_type()); // add message type to string
   // add arguments
-  for (unsigned i = 0; i<msg.get_num_args(); i++){ 
-    encoded_msg += " " + msg.get_arg(i);
+  for (unsigned i = 0; i<msg.get_num_args(); i++){
+    out += ' ';
+    out += msg.get_arg(i);
   }
-  encoded_msg += "\n"; // add null terminator
+  out += '\n'; // add null terminator
   // check if it's over max length
-  if (encoded_msg.size() > msg.MAX_ENCODED_LEN) {
+  if (out.size() - start > Message::MAX_ENCODED_LEN) {
+    out.resize(start);
     throw InvalidMessage("Message is too long");
   }
 }
 
-void MessageSerialization::decode( const std::string &encoded_msg_, Message &msg )
+void MessageSerialization::encode_binary_append( const Message &msg, std::string &out )
+{
+  size_t start = out.size();
+  if (msg.get_num_args() > UINT8_MAX) {
+    throw InvalidMessage("Message has too many arguments");
+  }
+  BinaryIO::put_u32(out, 0); // length, filled in below
+  BinaryIO::put_u8(out, wire_code(msg.get_message_type()));
+  BinaryIO::put_u8(out, msg.get_num_args());
+  for (unsigned i = 0; i < msg.get_num_args(); i++) {
+    const std::string &arg = msg.get_arg(i);
+    BinaryIO::put_u32(out, arg.size());
+    out += arg;
+  }
+
+  size_t len = out.size() - start - BINARY_HEADER_LEN;
+  if (len > Message::MAX_BINARY_LEN) {
+    out.resize(start);
+    throw InvalidMessage("Message is too long");
+  }
+  for (unsigned i = 0; i < BINARY_HEADER_LEN; i++) { // little-endian, like BinaryIO
+    out[start + i] = char((len >> (8 * i)) & 0xff);
+  }
+}
+
+void MessageSerialization::decode_binary( std::string_view payload, Message &msg )
+{
+  msg.clear();
+  if (payload.size() > Message::MAX_BINARY_LEN) {
+    throw InvalidMessage("\"Source message is too long\"");
+  }
+
+  const char *pos = payload.data();
+  const char *end = pos + payload.size();
+  uint8_t code, num_args;
+  if (!BinaryIO::get_u8(pos, end, code) || !BinaryIO::get_u8(pos, end, num_args)) {
+    throw InvalidMessage("\"Truncated message\"");
+  }
+  if (code >= NUM_WIRE_TYPES) {
+    throw InvalidMessage("\"Invalid message type\"");
+  }
+  msg.set_message_type(WIRE_TYPES[code]);
+  for (unsigned i = 0; i < num_args; i++) {
+    uint32_t len;
+    if (!BinaryIO::get_u32(pos, end, len) || uint32_t(end - pos) < len) {
+      throw InvalidMessage("\"Truncated message\"");
+    }
+    msg.push_arg(std::string_view(pos, len));
+    pos += len;
+  }
+
+  if (pos != end || !msg.is_valid(Message::MAX_BINARY_LEN)) {
+    throw InvalidMessage("\"Invalid arguments (number and/or format)\"");
+  }
+}
+
+bool MessageSerialization::binary_frame_len( std::string_view buf, uint32_t &len )
 {
-  // string --> Message
-  static std::map<std:: string, MessageType> string_to_message = { 
-    {"LOGIN", MessageType::LOGIN}, {"CREATE", MessageType::CREATE}, 
-    {"PUSH", MessageType::PUSH}, {"POP", MessageType::POP}, {"TOP", MessageType::TOP}, 
-    {"SET", MessageType::SET}, {"GET", MessageType::GET}, {"ADD", MessageType::ADD}, 
-    {"MUL", MessageType::MUL}, {"SUB", MessageType::SUB}, {"DIV", MessageType::DIV}, 
-    {"BEGIN", MessageType::BEGIN}, {"COMMIT", MessageType::COMMIT}, {"BYE", MessageType::BYE}, 
-    {"OK", MessageType::OK}, {"FAILED", MessageType::FAILED}, {"ERROR", MessageType::ERROR}, 
-    {"DATA", MessageType::DATA}
-  };
+  const char *pos = buf.data();
+  return BinaryIO::get_u32(pos, pos + buf.size(), len);
+}
 
-  msg = Message(); // clear message
+void MessageSerialization::decode( std::string_view encoded_msg_, Message &msg )
+{
+  msg.clear(); // clear message
 
-  check_exceptions(encoded_msg_, msg);
+  check_exceptions(encoded_msg_);
+  encoded_msg_.remove_suffix(1); // drop the newline
 
   // get message type
-  unsigned index = 0; // keeps track of current index in string
-  std::string msg_type_str = extract_string(encoded_msg_, index);
-  remove_null_char(msg_type_str);
-  msg.set_message_type(string_to_message[msg_type_str]);
+  size_t index = 0; // keeps track of current index in string
+  msg.set_message_type(lookup_command(extract_string(encoded_msg_, index)));
 
   // get arguments
   while (index < encoded_msg_.length()){
-    std::string arg_str = extract_string(encoded_msg_, index);
-    if(arg_str.empty() || arg_str == "\n"){ // no arguments left
+    std::string_view arg_str = extract_string(encoded_msg_, index);
+    if(arg_str.empty()){ // no arguments left
       break;
     }
-    remove_null_char(arg_str);
-    msg.push_arg(arg_str); 
-  } 
+    msg.push_arg(arg_str);
+  }
 
   if(!msg.is_valid()){
     throw InvalidMessage("\"Invalid arguments (number and/or format)\"");
   }
 }
 
- void MessageSerialization::check_exceptions(const std::string &encoded_msg_, Message &msg)
+ void MessageSerialization::check_exceptions(std::string_view encoded_msg_)
  {
   // check for max size
-  if(encoded_msg_.size() > msg.MAX_ENCODED_LEN){
+  if(encoded_msg_.size() > Message::MAX_ENCODED_LEN){
     throw InvalidMessage("\"Source message is too long\"");
   }
   // check for null terminator at the end
-  if(encoded_msg_.back() != '\n'){
+  if(encoded_msg_.empty() || encoded_msg_.back() != '\n'){
     throw InvalidMessage("\"Source message lacking terminating newline.\"");
   }
  }
 
- std::string MessageSerialization::extract_string(const std::string &encoded_msg_, unsigned &index)
+ std::string_view MessageSerialization::extract_string(std::string_view encoded_msg_, size_t &index)
  {
-  unsigned start = index; // start at current index
+  size_t start = index; // start at current index
   // doesn't start until after whitespaces
-  while(encoded_msg_[start] == ' '){
+  while(start < encoded_msg_.length() && encoded_msg_[start] == ' '){
     start++;
   }
 
-  unsigned end = start;
-  if(encoded_msg_[start] == '\"'){ // if string starts with a quotation mark
+  size_t end = start;
+  if(start < encoded_msg_.length() && encoded_msg_[start] == '\"'){ // if string starts with a quotation mark
     start++; // skip quotation mark
     end++;
-    while(encoded_msg_[end] != '\"' && end < encoded_msg_.length()){ // end at next quotation mark
+    while(end < encoded_msg_.length() && encoded_msg_[end] != '\"'){ // end at next quotation mark
       end++;
     }
   } else { // not a quoted text
-    while(encoded_msg_[end] != ' ' && end < encoded_msg_.length()){
+    while(end < encoded_msg_.length() && encoded_msg_[end] != ' '){
       end++;
     } // end at next whitespace or at the end of the string
   }
 
   index = end + 1; // update current index
 
-  return encoded_msg_.substr(start, end - start); // extract string
+  return encoded_msg_.substr(start, end - start); // view of the string, no copy
  }
 
- void MessageSerialization::remove_null_char(std::string &string)
- {  // find position of null character and erase it
-    size_t null_pos = string.find('\n');
-    if(null_pos!= std::string::npos){
-      string.erase(null_pos);
+ MessageType MessageSerialization::lookup_command(std::string_view command)
+ {
+  // switch on the length and first letter so at most two comparisons
+  // are needed (unknown commands are NONE)
+  switch (command.size()) {
+  case 2:
+    if (command == "OK") return MessageType::OK;
+    break;
+  case 3:
+    switch (command[0]) {
+    case 'A': if (command == "ADD") return MessageType::ADD; break;
+    case 'B': if (command == "BYE") return MessageType::BYE; break;
+    case 'D': if (command == "DIV") return MessageType::DIV; break;
+    case 'G': if (command == "GET") return MessageType::GET; break;
+    case 'M': if (command == "MUL") return MessageType::MUL; break;
+    case 'P': if (command == "POP") return MessageType::POP; break;
+    case 'T': if (command == "TOP") return MessageType::TOP; break;
+    case 'S':
+      if (command == "SET") return MessageType::SET;
+      if (command == "SUB") return MessageType::SUB;
+      break;
     }
+    break;
+  case 4:
+    switch (command[0]) {
+    case 'P': if (command == "PUSH") return MessageType::PUSH; break;
+    case 'D': if (command == "DATA") return MessageType::DATA; break;
+    case 'I': if (command == "INCR") return MessageType::INCR; break;
+    case 'C': if (command == "CALL") return MessageType::CALL; break;
+    case 'S': if (command == "SCAN") return MessageType::SCAN; break;
+    case 'F':
+      switch (command[1]) {
+      case 'A': if (command == "FADD") return MessageType::FADD; break;
+      case 'S': if (command == "FSUB") return MessageType::FSUB; break;
+      case 'M': if (command == "FMUL") return MessageType::FMUL; break;
+      }
+      break;
+    case 'M':
+      if (command == "MGET") return MessageType::MGET;
+      if (command == "MSET") return MessageType::MSET;
+      break;
+    }
+    break;
+  case 5:
+    switch (command[0]) {
+    case 'L': if (command == "LOGIN") return MessageType::LOGIN; break;
+    case 'B': if (command == "BEGIN") return MessageType::BEGIN; break;
+    case 'E':
+      if (command == "ERROR") return MessageType::ERROR;
+      if (command == "ENTRY") return MessageType::ENTRY;
+      break;
+    case 'S': if (command == "STATS") return MessageType::STATS; break;
+    }
+    break;
+  case 6:
+    switch (command[0]) {
+    case 'F': if (command == "FAILED") return MessageType::FAILED; break;
+    case 'P': if (command == "PREFIX") return MessageType::PREFIX; break;
+    case 'C':
+      if (command == "CREATE") return MessageType::CREATE;
+      if (command == "COMMIT") return MessageType::COMMIT;
+      break;
+    }
+    break;
+  case 7:
+    if (command == "DEFPROC") return MessageType::DEFPROC;
+    if (command == "ENDPROC") return MessageType::ENDPROC;
+    break;
+  }
+  return MessageType::NONE;
+ }
+
+ std::string_view MessageSerialization::command_name(MessageType type)
+ {
+  switch (type) {
+  case MessageType::LOGIN: return "LOGIN";
+  case MessageType::CREATE: return "CREATE";
+  case MessageType::PUSH: return "PUSH";
+  case MessageType::POP: return "POP";
+  case MessageType::TOP: return "TOP";
+  case MessageType::SET: return "SET";
+  case MessageType::GET: return "GET";
+  case MessageType::MGET: return "MGET";
+  case MessageType::MSET: return "MSET";
+  case MessageType::INCR: return "INCR";
+  case MessageType::FADD: return "FADD";
+  case MessageType::FSUB: return "FSUB";
+  case MessageType::FMUL: return "FMUL";
+  case MessageType::DEFPROC: return "DEFPROC";
+  case MessageType::ENDPROC: return "ENDPROC";
+  case MessageType::CALL: return "CALL";
+  case MessageType::STATS: return "STATS";
+  case MessageType::SCAN: return "SCAN";
+  case MessageType::PREFIX: return "PREFIX";
+  case MessageType::ADD: return "ADD";
+  case MessageType::SUB: return "SUB";
+  case MessageType::MUL: return "MUL";
+  case MessageType::DIV: return "DIV";
+  case MessageType::BEGIN: return "BEGIN";
+  case MessageType::COMMIT: return "COMMIT";
+  case MessageType::BYE: return "BYE";
+  case MessageType::OK: return "OK";
+  case MessageType::FAILED: return "FAILED";
+  case MessageType::ERROR: return "ERROR";
+  case MessageType::DATA: return "DATA";
+  case MessageType::ENTRY: return "ENTRY";
+  case MessageType::NONE: break;
+  }
+  return "";
  }
@@ -1,16 +1,40 @@
 #ifndef MESSAGE_SERIALIZATION_H
 #define MESSAGE_SERIALIZATION_H
 
+#include <string_view>
+#include <cstdint>
 #include "message.h"
 
 namespace MessageSerialization {
   void encode(const Message &msg, std::string &encoded_msg);
-  void decode(const std::string &encoded_msg, Message &msg);
+  // like encode, but appends to out (e.g. a connection's output buffer)
+  // instead of replacing it; out is left as it was if msg is too long
+  void encode_append(const Message &msg, std::string &out);
+  // decodes straight from the given bytes (e.g. the connection's read
+  // buffer); reusing msg across calls avoids allocating for its arguments
+  void decode(std::string_view encoded_msg, Message &msg);
+
+  // Binary protocol: a connection whose first byte is BINARY_MAGIC uses
+  // length-prefixed frames instead of lines, in both directions. A frame
+  // is a u32 payload length followed by the payload: a u8 type code, a u8
+  // argument count, and each argument as a u32 length and its bytes (all
+  // little-endian). Parsing is fixed-offset reads, and arguments may be
+  // up to Message::MAX_BINARY_LEN long.
+  const unsigned char BINARY_MAGIC = 0xB7;
+  const unsigned BINARY_HEADER_LEN = 4;
+  // append msg as a complete frame; out is left as it was if msg is too long
+  void encode_binary_append(const Message &msg, std::string &out);
+  // decode a frame's payload (without the length header)
+  void decode_binary(std::string_view payload, Message &msg);
+  // read the payload length from the frame header at the start of buf,
+  // returns false if the header isn't all there yet
+  bool binary_frame_len(std::string_view buf, uint32_t &len);
 
   // helper functions:
-  void check_exceptions(const std::string &encoded_msg, Message &msg);
-  std::string extract_string(const std::string &encoded_msg_, unsigned &index);
-  void remove_null_char(std::string &string);
+  void check_exceptions(std::string_view encoded_msg);
+  std::string_view extract_string(std::string_view encoded_msg, size_t &index);
+  MessageType lookup_command(std::string_view command);
+  std::string_view command_name(MessageType type);
 };
 
 #endif // MESSAGE_SERIALIZATION_H
@@ -0,0 +1,75 @@
+#include <iostream>
+#include <string>
+#include "message.h"
+#include "exceptions.h"
+#include "client_util.h"
+
+// entries asked for per SCAN/PREFIX (the server sends at most 1000)
+const char BATCH_SIZE[] = "1000";
+
+int main(int argc, char **argv)
+{
+  if ( argc != 5 && argc != 6 ) {
+    std::cerr << "Usage: ./scan_table <hostname> <port> <username> <table> [<prefix>]\n";
+    return 1;
+  }
+
+  std::string hostname = argv[1];
+  std::string port = argv[2];
+  std::string username = argv[3];
+  std::string table = argv[4];
+
+  try {
+    ClientUtil client;
+    client.connect(hostname, port);
+    if (!ClientUtil::check_reply(client.request(Message(MessageType::LOGIN, {username})))) {
+      return 1;
+    }
+
+    // print "key value" for every committed entry, in key order, a batch
+    // at a time: each batch streams back as ENTRY replies, then OK at the
+    // end of the table or DATA <last key> to resume after
+    std::string after;
+    bool done = false;
+    while (!done) {
+      Message scan = argc == 6 ? Message(MessageType::PREFIX, {table, argv[5], BATCH_SIZE})
+                               : Message(MessageType::SCAN, {table, BATCH_SIZE});
+      if (!after.empty()) {
+        scan.push_arg(after);
+      }
+      client.send({ scan });
+
+      Message reply;
+      while (true) {
+        if (!client.receive(reply)) {
+          std::cerr << "Error: could not read response from server\n";
+          return 1;
+        }
+        if (reply.get_message_type() != MessageType::ENTRY) {
+          break;
+        }
+        std::cout << reply.get_arg(0) << " " << reply.get_arg(1) << "\n";
+      }
+      if (reply.get_message_type() == MessageType::DATA) {
+        after = reply.get_value();
+      } else if (ClientUtil::check_reply(reply)) {
+        done = true;
+      } else {
+        return 1;
+      }
+    }
+
+    client.request(Message(MessageType::BYE));
+    return 0;
+
+  } catch (CommException &ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    return 1;
+  } catch (InvalidMessage &ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    return 1;
+  } catch (...) {
+    std::cerr << "Error: unexpected error\n";
+    return 1;
+  }
+}
@@ -1,23 +1,55 @@
 #include <iostream>
+#include <sstream>
 #include <cassert>
 #include <memory>
+#include <sys/wait.h>
 #include "csapp.h"
 #include "exceptions.h"
 #include "guard.h"
 #include "server.h"
+#include "event_loop.h"
+#include "connection_queue.h"
+#include "write_ahead_log.h"
+#include "snapshot.h"
+#include "message_serialization.h"
 
 
 Server::Server()
+  : m_mode( ServerMode::THREAD_PER_CLIENT )
+  , m_num_loops( 0 )
+  , m_num_workers( 0 )
+  , m_refuse_when_full( false )
+  , m_queue( nullptr )
+  , m_stats_interval( 0 )
+  , m_txn_mode( TransactionMode::LOCKING )
+  , m_next_txn_ts( 1 )
+  , m_wal( nullptr )
+  , m_checkpoint_interval( 0 )
+  , m_commit_lock_profile( "server:commit" )
+  , m_mutex_profile( "server:create" )
+  , m_procedures_lock_profile( "server:procedures" )
+  , m_lock_profile_top( 0 )
 {
   pthread_mutex_init(&mutex, NULL);
-  pthread_mutex_init(&mutex_for_tables, NULL);  
+  // prefer the checkpoint, so a steady stream of commits can't starve it
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&m_commit_lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  pthread_rwlock_init(&m_procedures_lock, NULL);
 }
 
 Server::~Server()
 {
   Close(socket_fd);
+  for (EventLoop *loop : m_loops) {
+    delete loop;
+  }
+  delete m_queue;
+  pthread_rwlock_destroy(&m_commit_lock);
+  pthread_rwlock_destroy(&m_procedures_lock);
   pthread_mutex_destroy(&mutex);
-  pthread_mutex_destroy(&mutex_for_tables);
 }
 
 void Server::listen( const std::string &port )
@@ -37,23 +69,300 @@ void Server::listen( const std::string &port )
   }
 }
 
+void Server::set_event_loop_mode( unsigned num_loops )
+{
+  if (num_loops == 0) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_loops = ncpus > 0 ? ncpus : 1;
+  }
+  m_mode = ServerMode::EVENT_LOOP;
+  m_num_loops = num_loops;
+}
+
+void Server::set_worker_pool_mode( unsigned num_workers, unsigned queue_capacity, bool refuse_when_full )
+{
+  m_mode = ServerMode::WORKER_POOL;
+  m_num_workers = num_workers;
+  m_refuse_when_full = refuse_when_full;
+  m_queue = new ConnectionQueue( queue_capacity );
+}
+
+void Server::set_stats_interval( unsigned interval )
+{
+  m_stats_interval = interval;
+}
+
+void Server::set_checkpoint_interval( unsigned interval )
+{
+  m_checkpoint_interval = interval;
+}
+
 void Server::server_loop()
 {
+  if (m_stats_interval > 0) {
+    pthread_t thr_id;
+    if (pthread_create(&thr_id, nullptr, stats_worker, this) != 0) {
+      fatal("Could not create stats thread");
+    }
+    pthread_detach(thr_id);
+  }
+  if (m_checkpoint_interval > 0 && m_wal != nullptr) {
+    pthread_t thr_id;
+    if (pthread_create(&thr_id, nullptr, checkpoint_worker, this) != 0) {
+      fatal("Could not create checkpoint thread");
+    }
+    pthread_detach(thr_id);
+  }
+
+  if (m_mode == ServerMode::EVENT_LOOP) {
+    event_loop_server();
+    return;
+  } else if (m_mode == ServerMode::WORKER_POOL) {
+    worker_pool_server();
+    return;
+  }
+
   while(true) { // continuously accept new connections
     struct sockaddr_in clientaddr;
     int client_fd = accept_connection(socket_fd, &clientaddr); // accept
+    if (client_fd < 0) continue;
     ClientConnection *client = new ClientConnection( this, client_fd ); // create client
     // create thread
     pthread_t thr_id;
     if ( pthread_create( &thr_id, nullptr, client_worker, client ) != 0 ){
       log_error( "Could not create client thread" );
       delete client;
-      pthread_detach( pthread_self() ); // detach
       continue;
-    } 
+    }
+    pthread_detach( thr_id ); // thread cleans up after itself
+  }
+}
+
+
+void Server::event_loop_server()
+{
+  // start the reactor threads
+  for (unsigned i = 0; i < m_num_loops; i++) {
+    EventLoop *loop = new EventLoop( this );
+    m_loops.push_back(loop);
+    loop->start();
+  }
+
+  unsigned next_loop = 0;
+  while(true) { // continuously accept new connections
+    struct sockaddr_in clientaddr;
+    int client_fd = accept_connection(socket_fd, &clientaddr); // accept
+    if (client_fd < 0) continue;
+    // hand the connection to the loops round-robin
+    ClientConnection *client = new ClientConnection( this, client_fd );
+    m_loops[next_loop]->add_client(client);
+    next_loop = (next_loop + 1) % m_num_loops;
   }
 }
 
+void Server::worker_pool_server()
+{
+  // pre-spawn the workers
+  for (unsigned i = 0; i < m_num_workers; i++) {
+    pthread_t thr_id;
+    if (pthread_create(&thr_id, nullptr, pool_worker, this) != 0) {
+      fatal("Could not create worker thread");
+    }
+    pthread_detach(thr_id);
+  }
+
+  while(true) { // continuously accept new connections
+    struct sockaddr_in clientaddr;
+    int client_fd = accept_connection(socket_fd, &clientaddr); // accept
+    if (client_fd < 0) continue;
+    // blocks here (so the listen backlog fills up) while the queue is full,
+    // unless we were told to refuse instead
+    if (!m_queue->push(client_fd, !m_refuse_when_full)) {
+      std::string busy = "ERROR \"Server is busy\"\n";
+      rio_writen(client_fd, busy.c_str(), busy.length());
+      Close(client_fd);
+    }
+  }
+}
+
+void *Server::pool_worker( void *arg )
+{
+  Server *server = static_cast<Server *>( arg );
+  while(true) { // serve one client at a time, forever
+    int client_fd = server->m_queue->pop();
+    ClientConnection client( server, client_fd );
+    client.chat_with_client();
+  }
+  return nullptr;
+}
+
+void *Server::stats_worker( void *arg )
+{
+  Server *server = static_cast<Server *>( arg );
+  while(true) {
+    sleep(server->m_stats_interval);
+    server->log_stats();
+  }
+  return nullptr;
+}
+
+void *Server::checkpoint_worker( void *arg )
+{
+  Server *server = static_cast<Server *>( arg );
+  while(true) {
+    sleep(server->m_checkpoint_interval);
+    unsigned long lsn;
+    pid_t pid = server->checkpoint(lsn);
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      server->log_error("Checkpoint failed");
+    } else if (!server->m_wal->discard_before(lsn)) {
+      // the snapshot is in place, so replay never reads the log before lsn
+      server->log_error("Could not discard the write-ahead log before the checkpoint");
+    }
+  }
+  return nullptr;
+}
+
+pid_t Server::checkpoint( unsigned long &lsn )
+{
+  // stop creates and commits, and freeze every table so that the
+  // committed data matches the log exactly up to end_lsn()
+  Guard g(mutex, m_mutex_profile);
+  LockProfiler::wrlock(m_commit_lock, m_commit_lock_profile);
+  std::vector<Table*> all;
+  tables.get_all(all);
+  for (Table *table : all) {
+    table->freeze();
+  }
+  lsn = m_wal->end_lsn();
+
+  // the child gets a copy-on-write image of the frozen tables, so the
+  // server only pauses for as long as fork() takes
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(Snapshot::write(m_snapshot_path, all, lsn) ? 0 : 1);
+  }
+
+  for (Table *table : all) {
+    table->thaw();
+  }
+  pthread_rwlock_unlock(&m_commit_lock);
+  return pid;
+}
+
+namespace {
+
+std::string format_command_stats( const ServerMetrics::CommandMetrics &command, char sep )
+{
+  std::ostringstream out;
+  out << "count=" << command.count
+      << sep << "failed=" << command.failed
+      << sep << "mean_us=" << uint64_t(command.latency.mean())
+      << sep << "p50_us=" << command.latency.percentile(50)
+      << sep << "p90_us=" << command.latency.percentile(90)
+      << sep << "p99_us=" << command.latency.percentile(99)
+      << sep << "max_us=" << command.latency.max();
+  return out.str();
+}
+
+}
+
+void Server::log_stats()
+{
+  ServerMetrics::Report report;
+  m_metrics.get_report(report);
+  std::ostringstream out;
+  out << "Stats: " << stats_summary(' ') << "\n";
+  for (size_t i = 0; i < report.commands.size(); i++) {
+    if (report.commands[i].count > 0) {
+      std::string_view name = MessageSerialization::command_name(MessageType(i));
+      out << "Stats: command=" << (name.empty() ? "invalid" : name) << " "
+          << format_command_stats(report.commands[i], ' ') << "\n";
+    }
+  }
+  if (m_lock_profile_top > 0) {
+    LockProfiler::report(out, m_lock_profile_top, "Stats: ");
+  }
+  std::cerr << out.str();
+}
+
+bool Server::set_lock_profiling( unsigned top_n )
+{
+  if (!LockProfiler::set_enabled(top_n > 0)) {
+    return false;
+  }
+  m_lock_profile_top = top_n;
+  return true;
+}
+
+std::string Server::stats_summary( char sep )
+{
+  ServerMetrics::Report report;
+  m_metrics.get_report(report);
+  uint64_t requests = 0, failed = 0;
+  for (const ServerMetrics::CommandMetrics &command : report.commands) {
+    requests += command.count;
+    failed += command.failed;
+  }
+
+  std::ostringstream out;
+  out << "connections=" << m_metrics.get_connections()
+      << sep << "connections_total=" << m_metrics.get_connections_total()
+      << sep << "requests=" << requests
+      << sep << "requests_failed=" << failed;
+  if (m_mode == ServerMode::WORKER_POOL) {
+    ConnectionQueueStats qs = m_queue->get_stats();
+    double avg_wait = qs.dequeued > 0 ? qs.total_wait_ms / qs.dequeued : 0.0;
+    out << sep << "workers=" << m_num_workers
+        << sep << "queue_depth=" << qs.depth
+        << sep << "queue_max_depth=" << qs.max_depth
+        << sep << "enqueued=" << qs.enqueued
+        << sep << "delayed=" << qs.delayed
+        << sep << "refused=" << qs.refused
+        << sep << "avg_wait_ms=" << avg_wait
+        << sep << "max_wait_ms=" << qs.max_wait_ms;
+  }
+  unsigned long begun = m_txn_stats.begun;
+  unsigned long aborted = m_txn_stats.aborted;
+  out << sep << "txn_mode=" << (m_txn_mode == TransactionMode::OPTIMISTIC ? "occ"
+                                : m_txn_mode == TransactionMode::WAIT_DIE ? "wait" : "lock")
+      << sep << "txn_begun=" << begun
+      << sep << "txn_committed=" << m_txn_stats.committed
+      << sep << "txn_aborted=" << aborted
+      << sep << "txn_abort_rate=" << (begun > 0 ? double(aborted) / begun : 0.0)
+      << sep << "txn_lock_conflicts=" << m_txn_stats.lock_conflicts
+      << sep << "txn_lock_waits=" << m_txn_stats.lock_waits
+      << sep << "txn_validation_conflicts=" << m_txn_stats.validation_conflicts
+      << sep << "txn_retries=" << m_txn_stats.retries;
+  out << sep << "lock_wait_p50_us=" << report.locks.wait.percentile(50)
+      << sep << "lock_wait_p99_us=" << report.locks.wait.percentile(99)
+      << sep << "lock_wait_max_us=" << report.locks.wait.max()
+      << sep << "lock_hold_p50_us=" << report.locks.hold.percentile(50)
+      << sep << "lock_hold_p99_us=" << report.locks.hold.percentile(99)
+      << sep << "lock_hold_max_us=" << report.locks.hold.max()
+      << sep << "lock_busy=" << report.locks.busy;
+  if (m_wal != nullptr) {
+    unsigned long records, flushes;
+    m_wal->get_stats(records, flushes);
+    out << sep << "wal_records=" << records
+        << sep << "wal_fsyncs=" << flushes
+        << sep << "wal_records_per_fsync=" << (flushes > 0 ? double(records) / flushes : 0.0);
+  }
+  return out.str();
+}
+
+std::string Server::command_stats( MessageType type, char sep )
+{
+  ServerMetrics::Report report;
+  m_metrics.get_report(report);
+  unsigned index = unsigned(type);
+  if (index >= report.commands.size() || report.commands[index].count == 0) {
+    return "";
+  }
+  return format_command_stats(report.commands[index], sep);
+}
 
 void *Server::client_worker( void *arg )
 {
@@ -85,27 +394,139 @@ int Server::accept_connection(int socket_fd, struct sockaddr_in *clientaddr)
   return client_fd;
 }
 
-void Server::create_table( const std::string &name )
+unsigned long Server::create_table( const std::string &name, StorageEngine engine )
 {
-  pthread_mutex_lock(&mutex_for_tables);
-  if (tables.find(name) != tables.end()) {
-    pthread_mutex_unlock(&mutex_for_tables);
-    throw OperationException("\"already created\"");
+  unsigned long lsn = 0;
+  {
+    // creates are rare, so one mutex keeps the check, the log record and
+    // the insert together (the CREATE record has to be in the log before
+    // anyone can find the table and log a SET to it)
+    Guard g(mutex, m_mutex_profile);
+    if (tables.find(name) != nullptr) {
+      throw OperationException("\"already created\"");
+    }
+    if (m_wal != nullptr) {
+      lsn = m_wal->log_create(name, engine);
+    }
+    tables.add(new Table(name, engine));
   }
-  Table *table = new Table(name);
-  tables[name] = table;
-  pthread_mutex_unlock(&mutex_for_tables);
+  return lsn;
 }
 
 Table* Server::find_table( const std::string &name )
 {
-  pthread_mutex_lock(&mutex_for_tables);
-  Table *t = nullptr;
-  if (tables.find(name) != tables.end()) {
-    t = tables[name];
+  return tables.find(name);
+}
+
+void Server::define_procedure( const std::string &name, const std::vector<Message> &steps )
+{
+  Procedure proc = std::make_shared<const std::vector<Message>>(steps);
+  LockProfiler::wrlock(m_procedures_lock, m_procedures_lock_profile);
+  m_procedures[name] = proc;
+  pthread_rwlock_unlock(&m_procedures_lock);
+}
+
+Procedure Server::find_procedure( const std::string &name )
+{
+  Procedure proc;
+  LockProfiler::rdlock(m_procedures_lock, m_procedures_lock_profile);
+  auto it = m_procedures.find(name);
+  if (it != m_procedures.end()) {
+    proc = it->second;
+  }
+  pthread_rwlock_unlock(&m_procedures_lock);
+  return proc;
+}
+
+void Server::enable_wal( const std::string &path )
+{
+  // start from the last checkpoint, if there is one
+  m_snapshot_path = path + ".snap";
+  unsigned long start = 0;
+  bool have_snapshot = Snapshot::load(m_snapshot_path, start,
+    [this]( const std::string &name, StorageEngine engine ) {
+      tables.add(new Table(name, engine));
+    },
+    [this]( const std::string &name, const std::string &key, const std::string &value ) {
+      Table *table = tables.find(name);
+      unsigned stripe = table->stripe_of(key);
+      table->lock_stripe(stripe);
+      table->set(key, value);
+      table->commit_stripe(stripe);
+      table->unlock_stripe(stripe);
+    });
+  if (!have_snapshot) {
+    start = 0;
+  }
+
+  // redo every intact record after it, in order
+  unsigned long end = WriteAheadLog::replay(path, start,
+    [this]( const std::string &name, StorageEngine engine ) {
+      if (tables.find(name) == nullptr) {
+        tables.add(new Table(name, engine));
+      }
+    },
+    [this]( const std::vector<WalWrite> &writes ) {
+      for (const WalWrite &write : writes) {
+        Table *table = tables.find(write.table);
+        if (table == nullptr) {
+          continue; // can't happen unless the log is damaged
+        }
+        unsigned stripe = table->stripe_of(write.key);
+        table->lock_stripe(stripe);
+        table->set(write.key, write.value);
+        table->commit_stripe(stripe);
+        table->unlock_stripe(stripe);
+      }
+    });
+
+  if (end < start) {
+    end = start; // the log is gone, keep LSNs after the snapshot's
+  }
+
+  m_wal = new WriteAheadLog();
+  m_wal->open(path, end);
+}
+
+unsigned long Server::log_commit( const std::vector<WalWrite> &writes )
+{
+  if (m_wal == nullptr || writes.empty()) {
+    return 0;
+  }
+  return m_wal->log_commit(writes);
+}
+
+void Server::wait_durable( unsigned long lsn )
+{
+  if (m_wal != nullptr && lsn > 0) {
+    m_wal->wait_durable(lsn);
+  }
+}
+
+bool Server::is_durable( unsigned long lsn )
+{
+  return m_wal == nullptr || lsn == 0 || m_wal->is_durable(lsn);
+}
+
+void Server::add_durable_listener( int fd )
+{
+  if (m_wal != nullptr) {
+    m_wal->add_durable_listener(fd);
+  }
+}
+
+void Server::begin_commit()
+{
+  if (m_wal != nullptr) {
+    LockProfiler::rdlock(m_commit_lock, m_commit_lock_profile);
+  }
+}
+
+void Server::end_commit()
+{
+  if (m_wal != nullptr) {
+    pthread_rwlock_unlock(&m_commit_lock);
   }
-  pthread_mutex_unlock(&mutex_for_tables);
-  return t;
 }
 
 void Server::fatal (std::string err_message)
@@ -3,17 +3,83 @@
 
 #include <map>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
 #include <pthread.h>
+#include <sys/types.h>
 #include "table.h"
+#include "table_registry.h"
 #include "client_connection.h"
+#include "server_metrics.h"
+#include "lock_profiler.h"
+
+class EventLoop; // forward declaration
+class ConnectionQueue; // forward declaration
+class WriteAheadLog; // forward declaration
+struct WalWrite; // forward declaration
+
+// How client connections are serviced
+enum class ServerMode {
+  THREAD_PER_CLIENT, // one detached thread per connection (default)
+  EVENT_LOOP,        // fixed number of epoll reactor threads
+  WORKER_POOL,       // fixed number of worker threads fed by a bounded queue
+};
+
+// How transactions are isolated from each other
+enum class TransactionMode {
+  LOCKING,    // lock stripes as they're touched, fail right away on conflict (default)
+  OPTIMISTIC, // buffer reads/writes privately, validate at COMMIT
+  WAIT_DIE,   // lock stripes as they're touched, an older transaction waits
+              // (briefly) for a younger one instead of failing
+};
+
+// Transaction counters (shared by all client threads)
+struct TransactionStats {
+  std::atomic<unsigned long> begun;
+  std::atomic<unsigned long> committed;
+  std::atomic<unsigned long> aborted;              // rolled back for any reason
+  std::atomic<unsigned long> lock_conflicts;       // LOCKING/WAIT_DIE: couldn't get a stripe
+  std::atomic<unsigned long> lock_waits;           // WAIT_DIE: waited for a stripe
+  std::atomic<unsigned long> validation_conflicts; // OPTIMISTIC: a read was stale at COMMIT
+  std::atomic<unsigned long> retries;              // BEGIN right after an aborted transaction
+
+  TransactionStats()
+    : begun( 0 ), committed( 0 ), aborted( 0 )
+    , lock_conflicts( 0 ), lock_waits( 0 ), validation_conflicts( 0 ), retries( 0 )
+  { }
+};
+
+// A stored procedure: the requests recorded between DEFPROC and ENDPROC.
+// Never changed once defined (redefining replaces it), so a CALL can keep
+// running its copy while someone else redefines it.
+typedef std::shared_ptr<const std::vector<Message>> Procedure;
 
 class Server {
 private:
   // TODO: add member variables
-  pthread_mutex_t mutex; // mutex for server
-  pthread_mutex_t mutex_for_tables; // new mutex to protect the tables map
+  ServerMode m_mode;
+  unsigned m_num_loops; // number of event loop threads (EVENT_LOOP mode)
+  std::vector<EventLoop*> m_loops;
+  unsigned m_num_workers; // number of pool threads (WORKER_POOL mode)
+  bool m_refuse_when_full; // refuse (rather than delay) accepts when the queue is full
+  ConnectionQueue *m_queue; // accepted fds waiting for a pool thread
+  unsigned m_stats_interval; // seconds between stats dumps (0 = never)
+  TransactionMode m_txn_mode;
+  TransactionStats m_txn_stats;
+  std::atomic<unsigned long> m_next_txn_ts; // wait-die timestamps, in BEGIN order
+  ServerMetrics m_metrics;
+  WriteAheadLog *m_wal; // nullptr unless durability is enabled
+  std::string m_snapshot_path; // where checkpoints of the tables are written
+  unsigned m_checkpoint_interval; // seconds between checkpoints (0 = never)
+  pthread_rwlock_t m_commit_lock; // read: logging+installing a commit, write: checkpoint
+  pthread_mutex_t mutex; // mutex for server (serializes CREATE)
+  LockProfiler::Counters m_commit_lock_profile, m_mutex_profile, m_procedures_lock_profile;
+  unsigned m_lock_profile_top; // hottest locks in the stats dump (0 = not profiling)
   int socket_fd;
-  std::map<std::string, Table*> tables; // map of tables (key is table name, value is table object)
+  TableRegistry tables; // sharded map of tables (key is table name, value is table object)
+  std::map<std::string, Procedure> m_procedures; // stored procedures by name (in memory only)
+  pthread_rwlock_t m_procedures_lock; // read: CALL, write: ENDPROC
 
   // copy constructor and assignment operator are prohibited
   Server( const Server & );
@@ -25,6 +91,64 @@ public:
 
   void listen( const std::string &port );
   void server_loop();
+  void event_loop_server(); // server_loop for EVENT_LOOP mode
+
+  // use num_loops epoll reactor threads instead of a thread per client
+  // (0 means one per online CPU)
+  void set_event_loop_mode( unsigned num_loops );
+
+  // serve clients from num_workers pre-spawned threads; at most queue_capacity
+  // accepted connections wait for a free worker
+  void set_worker_pool_mode( unsigned num_workers, unsigned queue_capacity, bool refuse_when_full );
+  void worker_pool_server(); // server_loop for WORKER_POOL mode
+  static void *pool_worker( void *arg );
+
+  // replay the write-ahead log at path (if it exists) to restore the
+  // tables, then log every committed change to it from now on
+  void enable_wal( const std::string &path );
+  // append committed writes to the log (if enabled), returning the LSN
+  // to pass to wait_durable; call while the written stripes are locked
+  unsigned long log_commit( const std::vector<WalWrite> &writes );
+  // wait until a logged commit is on disk (no-op without a log)
+  void wait_durable( unsigned long lsn );
+  // the same without waiting (true without a log), and an eventfd to
+  // be written whenever more might be (see WriteAheadLog)
+  bool is_durable( unsigned long lsn );
+  void add_durable_listener( int fd );
+  // bracket log_commit and the commit of the written stripes, so that
+  // a checkpoint never sees a commit that's logged but not yet installed
+  void begin_commit();
+  void end_commit();
+
+  // write a snapshot of every table next to the log every interval
+  // seconds, so startup only replays the log from the last snapshot
+  void set_checkpoint_interval( unsigned interval );
+  static void *checkpoint_worker( void *arg );
+  // fork a child to write a copy-on-write snapshot of the tables as of
+  // now (log position lsn); returns its pid (or -1), the caller must
+  // waitpid for it
+  pid_t checkpoint( unsigned long &lsn );
+
+  void set_transaction_mode( TransactionMode mode ) { m_txn_mode = mode; }
+  TransactionMode get_transaction_mode() const { return m_txn_mode; }
+  TransactionStats &get_txn_stats() { return m_txn_stats; }
+  unsigned long next_txn_timestamp() { return m_next_txn_ts++; }
+
+  // dump server statistics to stderr every interval seconds
+  void set_stats_interval( unsigned interval );
+  static void *stats_worker( void *arg );
+  void log_stats();
+
+  // profile lock contention (a LOCK_PROFILING build only, returns false
+  // otherwise) and add the top_n hottest locks to the stats dump
+  bool set_lock_profiling( unsigned top_n );
+
+  ServerMetrics &get_metrics() { return m_metrics; }
+  // statistics as key=value pairs separated by sep: everything in the
+  // stats dump but the per-command lines, or one command's (empty if it
+  // was never handled)
+  std::string stats_summary( char sep );
+  std::string command_stats( MessageType type, char sep );
 
   static void *client_worker( void *arg );
 
@@ -32,8 +156,11 @@ public:
 
   // TODO: add member functions
   int accept_connection(int socket_fd, struct sockaddr_in *clientaddr); 
-  void create_table( const std::string &name ); // suggested function
+  // returns the LSN to pass to wait_durable
+  unsigned long create_table( const std::string &name, StorageEngine engine = StorageEngine::MAP ); // suggested function
   Table *find_table( const std::string &name ); // suggested function
+  void define_procedure( const std::string &name, const std::vector<Message> &steps );
+  Procedure find_procedure( const std::string &name ); // nullptr if there's no such procedure
   void fatal (std::string err_message); 
 
 };
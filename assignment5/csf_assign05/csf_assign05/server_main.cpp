@@ -1,17 +1,107 @@
 #include <iostream>
+#include <string>
+#include <csignal>
+#include <unistd.h>
 #include "server.h"
 
+void usage()
+{
+  std::cerr << "Usage: ./server [-e <num loops> | -w <num workers> [-q <capacity>] [-r]] [-c lock|occ|wait] [-l <log file> [-k <secs>]] [-s <secs> [-p <num locks>]] <port>\n";
+  std::cerr << "Options:\n";
+  std::cerr << "  -e <num loops>   serve clients from epoll event loop threads\n";
+  std::cerr << "                   instead of one thread per client (0 = one per CPU)\n";
+  std::cerr << "  -w <num workers> serve clients from a fixed pool of worker threads\n";
+  std::cerr << "  -q <capacity>    max accepted connections waiting for a worker (default 64)\n";
+  std::cerr << "  -r               refuse connections when the queue is full (default: delay accepts)\n";
+  std::cerr << "  -c lock|occ|wait transactions lock as they go and fail on a conflict (default),\n";
+  std::cerr << "                   use optimistic concurrency control, validated at COMMIT,\n";
+  std::cerr << "                   or lock as they go and wait (wait-die) on a conflict\n";
+  std::cerr << "  -l <log file>    make commits durable in a write-ahead log (replayed at startup)\n";
+  std::cerr << "  -k <secs>        with -l, snapshot the tables every <secs> seconds so\n";
+  std::cerr << "                   startup only replays what was logged after it\n";
+  std::cerr << "  -s <secs>        dump server statistics to stderr every <secs> seconds\n";
+  std::cerr << "  -p <num locks>   with -s, profile lock contention and dump the <num locks>\n";
+  std::cerr << "                   hottest locks (needs a 'make LOCK_PROFILING=1' build)\n";
+}
+
 int main(int argc, char **argv)
 {
-  if ( argc != 2 ) {
-    std::cerr << "Usage: ./server <port>\n";
+  Server server;
+
+  unsigned num_workers = 0;
+  unsigned queue_capacity = 64;
+  std::string wal_path;
+  bool refuse_when_full = false;
+  bool event_loop = false, pool_options = false; // -e, and -q or -r (which need -w)
+  unsigned stats_interval = 0;
+  unsigned checkpoint_interval = 0;
+  bool lock_profiling = false;
+
+  int opt;
+  while ( (opt = getopt(argc, argv, "e:w:q:rc:l:k:s:p:")) != -1 ) {
+    try {
+      if ( opt == 'e' ) {
+        server.set_event_loop_mode( std::stoul(optarg) );
+        event_loop = true;
+      } else if ( opt == 'w' ) {
+        num_workers = std::stoul(optarg);
+      } else if ( opt == 'q' ) {
+        queue_capacity = std::stoul(optarg);
+        pool_options = true;
+      } else if ( opt == 'r' ) {
+        refuse_when_full = true;
+        pool_options = true;
+      } else if ( opt == 'c' && std::string(optarg) == "lock" ) {
+        server.set_transaction_mode( TransactionMode::LOCKING );
+      } else if ( opt == 'c' && std::string(optarg) == "occ" ) {
+        server.set_transaction_mode( TransactionMode::OPTIMISTIC );
+      } else if ( opt == 'c' && std::string(optarg) == "wait" ) {
+        server.set_transaction_mode( TransactionMode::WAIT_DIE );
+      } else if ( opt == 'l' ) {
+        wal_path = optarg;
+      } else if ( opt == 'k' ) {
+        checkpoint_interval = std::stoul(optarg);
+        server.set_checkpoint_interval( checkpoint_interval );
+      } else if ( opt == 's' ) {
+        stats_interval = std::stoul(optarg);
+        server.set_stats_interval( stats_interval );
+      } else if ( opt == 'p' ) {
+        lock_profiling = true;
+        if ( !server.set_lock_profiling( std::stoul(optarg) ) ) {
+          std::cerr << "Error: this server was built without lock profiling (make LOCK_PROFILING=1)\n";
+          return 1;
+        }
+      } else {
+        usage();
+        return 1;
+      }
+    } catch ( std::exception &ex ) {
+      usage();
+      return 1;
+    }
+  }
+
+  // -e and -w are different ways of serving clients, so only one can be used
+  if ( argc - optind != 1 || queue_capacity == 0
+       || ( event_loop && num_workers > 0 ) || ( pool_options && num_workers == 0 )
+       || ( lock_profiling && stats_interval == 0 ) // the profile is only reported in the dump
+       || ( checkpoint_interval > 0 && wal_path.empty() ) ) { // snapshots are of the log
+    usage();
     return 1;
   }
 
-  Server server;
+  if ( num_workers > 0 ) {
+    server.set_worker_pool_mode( num_workers, queue_capacity, refuse_when_full );
+  }
+
+  // a client hanging up before reading its reply shouldn't kill the server
+  signal( SIGPIPE, SIG_IGN );
 
   try {
-    server.listen( argv[1] );
+    if ( !wal_path.empty() ) {
+      server.enable_wal( wal_path );
+    }
+    server.listen( argv[optind] );
     server.server_loop();
   } catch ( std::runtime_error &ex ) {
     server.log_error( "Fatal error starting server" );
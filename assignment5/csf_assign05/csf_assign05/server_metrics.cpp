@@ -0,0 +1,161 @@
+#include <ctime>
+#include "guard.h"
+#include "server_metrics.h"
+
+namespace {
+
+// hands the thread's block back when the thread exits
+struct ThreadSlot {
+  ServerMetrics *owner;
+  ServerMetrics::ThreadMetrics *block;
+
+  ThreadSlot() : owner( nullptr ), block( nullptr ) { }
+  ~ThreadSlot()
+  {
+    if (block != nullptr) {
+      Table::set_lock_observer(nullptr);
+      owner->release(block);
+    }
+  }
+};
+
+thread_local ThreadSlot t_slot;
+
+// the block's own thread is the only writer, so no atomic add is needed
+void bump( std::atomic<uint64_t> &counter )
+{
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+}
+
+ServerMetrics::ThreadMetrics::ThreadMetrics()
+  : m_lock_wait( HISTOGRAM_SUB_BITS )
+  , m_lock_hold( HISTOGRAM_SUB_BITS )
+  , m_lock_busy( 0 )
+{
+  for (unsigned i = 0; i < NUM_COMMANDS; i++) {
+    m_commands[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+ServerMetrics::ThreadMetrics::~ThreadMetrics()
+{
+  for (unsigned i = 0; i < NUM_COMMANDS; i++) {
+    delete m_commands[i].load(std::memory_order_relaxed);
+  }
+}
+
+void ServerMetrics::ThreadMetrics::record_request( MessageType type, uint64_t latency_us, bool failed )
+{
+  unsigned index = unsigned(type);
+  if (index >= NUM_COMMANDS) {
+    index = unsigned(MessageType::NONE); // not a request
+  }
+  Command *command = m_commands[index].load(std::memory_order_relaxed);
+  if (command == nullptr) {
+    command = new Command();
+    m_commands[index].store(command, std::memory_order_release);
+  }
+  bump(command->count);
+  if (failed) {
+    bump(command->failed);
+  }
+  command->latency.record(latency_us);
+}
+
+void ServerMetrics::ThreadMetrics::stripe_locked( uint64_t wait_us )
+{
+  m_lock_wait.record(wait_us);
+}
+
+void ServerMetrics::ThreadMetrics::stripe_unlocked( uint64_t hold_us )
+{
+  m_lock_hold.record(hold_us);
+}
+
+void ServerMetrics::ThreadMetrics::stripe_busy()
+{
+  bump(m_lock_busy);
+}
+
+void ServerMetrics::ThreadMetrics::add_to( Report &report ) const
+{
+  if (report.commands.size() < NUM_COMMANDS) {
+    report.commands.resize(NUM_COMMANDS);
+  }
+  for (unsigned i = 0; i < NUM_COMMANDS; i++) {
+    const Command *command = m_commands[i].load(std::memory_order_acquire);
+    if (command != nullptr) {
+      report.commands[i].count += command->count.load(std::memory_order_relaxed);
+      report.commands[i].failed += command->failed.load(std::memory_order_relaxed);
+      command->latency.add_to(report.commands[i].latency);
+    }
+  }
+  m_lock_wait.add_to(report.locks.wait);
+  m_lock_hold.add_to(report.locks.hold);
+  report.locks.busy += m_lock_busy.load(std::memory_order_relaxed);
+}
+
+ServerMetrics::ServerMetrics()
+  : m_connections( 0 )
+  , m_connections_total( 0 )
+{
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+ServerMetrics::~ServerMetrics()
+{
+  if (t_slot.owner == this) {
+    Table::set_lock_observer(nullptr);
+    t_slot.owner = nullptr;
+    t_slot.block = nullptr;
+  }
+  for (ThreadMetrics *block : m_threads) {
+    delete block;
+  }
+  pthread_mutex_destroy(&m_lock);
+}
+
+ServerMetrics::ThreadMetrics *ServerMetrics::for_this_thread()
+{
+  if (t_slot.owner == this) {
+    return t_slot.block;
+  }
+  ThreadMetrics *block;
+  {
+    Guard g(m_lock);
+    if (!m_free.empty()) {
+      block = m_free.back();
+      m_free.pop_back();
+    } else {
+      block = new ThreadMetrics();
+      m_threads.push_back(block);
+    }
+  }
+  t_slot.owner = this;
+  t_slot.block = block;
+  Table::set_lock_observer(block);
+  return block;
+}
+
+void ServerMetrics::release( ThreadMetrics *block )
+{
+  Guard g(m_lock);
+  m_free.push_back(block);
+}
+
+void ServerMetrics::get_report( Report &report )
+{
+  Guard g(m_lock);
+  for (ThreadMetrics *block : m_threads) {
+    block->add_to(report);
+  }
+}
+
+uint64_t ServerMetrics::now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,114 @@
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include "message.h"
+#include "table.h"
+#include "latency_histogram.h"
+
+// Request and stripe lock metrics, cheap enough to leave on. Every thread
+// that handles requests records into a ThreadMetrics of its own, whose
+// counts are relaxed atomics that only that thread writes, so recording
+// takes no lock and never waits for another thread; a report just reads
+// every block's counts. Threads come and go in the thread-per-client
+// mode, so a block is handed back when its thread exits and reused
+// (counts and all) by the next one.
+class ServerMetrics {
+public:
+  // latencies are in microseconds, to within 1/16
+  static const unsigned HISTOGRAM_SUB_BITS = 4;
+
+  struct CommandMetrics {
+    uint64_t count;
+    uint64_t failed; // replied FAILED or ERROR
+    LatencyHistogram latency;
+
+    CommandMetrics() : count( 0 ), failed( 0 ), latency( HISTOGRAM_SUB_BITS ) { }
+  };
+
+  struct LockMetrics {
+    LatencyHistogram wait, hold; // stripe locks
+    uint64_t busy; // trylocks (or wait-die locks) that failed
+
+    LockMetrics() : wait( HISTOGRAM_SUB_BITS ), hold( HISTOGRAM_SUB_BITS ), busy( 0 ) { }
+  };
+
+  // everything recorded so far, summed over all threads
+  struct Report {
+    std::vector<CommandMetrics> commands; // indexed by MessageType
+    LockMetrics locks;
+  };
+
+  class ThreadMetrics : public LockObserver {
+  public:
+    // requests are recorded by MessageType, which puts them first
+    static const unsigned NUM_COMMANDS = unsigned(MessageType::BYE) + 1;
+
+  private:
+    struct Command {
+      std::atomic<uint64_t> count;
+      std::atomic<uint64_t> failed;
+      AtomicLatencyHistogram latency;
+
+      Command() : count( 0 ), failed( 0 ), latency( HISTOGRAM_SUB_BITS ) { }
+    };
+
+    // made on first use (and published with a release store, so a
+    // report never sees one half built)
+    std::atomic<Command*> m_commands[NUM_COMMANDS];
+    AtomicLatencyHistogram m_lock_wait, m_lock_hold;
+    std::atomic<uint64_t> m_lock_busy;
+
+    // copy constructor and assignment operator are prohibited
+    ThreadMetrics( const ThreadMetrics & );
+    ThreadMetrics &operator=( const ThreadMetrics & );
+
+  public:
+    ThreadMetrics();
+    ~ThreadMetrics();
+
+    // only ever called by the block's own thread
+    void record_request( MessageType type, uint64_t latency_us, bool failed );
+    void stripe_locked( uint64_t wait_us ) override;
+    void stripe_unlocked( uint64_t hold_us ) override;
+    void stripe_busy() override;
+
+    // from any thread, while the block's thread keeps recording
+    void add_to( Report &report ) const;
+  };
+
+private:
+  pthread_mutex_t m_lock; // protects m_threads and m_free
+  std::vector<ThreadMetrics*> m_threads; // every block ever made
+  std::vector<ThreadMetrics*> m_free; // blocks whose thread has exited
+  std::atomic<unsigned long> m_connections; // open right now
+  std::atomic<unsigned long> m_connections_total; // ever accepted
+
+  // copy constructor and assignment operator are prohibited
+  ServerMetrics( const ServerMetrics & );
+  ServerMetrics &operator=( const ServerMetrics & );
+
+public:
+  ServerMetrics();
+  ~ServerMetrics();
+
+  // the calling thread's block, made (or reused) on first use, which
+  // also becomes the thread's Table lock observer
+  ThreadMetrics *for_this_thread();
+  void release( ThreadMetrics *block ); // its thread has exited
+
+  void connection_opened() { m_connections++; m_connections_total++; }
+  void connection_closed() { m_connections--; }
+  unsigned long get_connections() const { return m_connections; }
+  unsigned long get_connections_total() const { return m_connections_total; }
+
+  void get_report( Report &report );
+
+  static uint64_t now_us(); // monotonic clock
+};
+
+#endif // SERVER_METRICS_H
@@ -1,14 +1,44 @@
 #include <iostream>
 #include <string>
-#include "csapp.h"
 #include "message.h"
-#include "message_serialization.h"
 #include "exceptions.h"
+#include "client_util.h"
+
+namespace {
+
+// log in, push the values, and pop them into their keys. Several pairs
+// use one MSET (the top value goes to the last key), unless the server
+// doesn't have it; a single pair is a plain SET, which any server
+// understands. If a PUSH fails, the stack is short a value, so setting
+// fails too.
+std::vector<Message> set_requests( const std::string &username, const std::string &table,
+                                   char **pairs, unsigned num_pairs, bool use_mset )
+{
+  std::vector<Message> requests = { Message(MessageType::LOGIN, {username}) };
+  for (unsigned i = 0; i < num_pairs; i++) {
+    requests.push_back(Message(MessageType::PUSH, {pairs[2 * i + 1]}));
+  }
+  if (use_mset) {
+    Message mset(MessageType::MSET, {table});
+    for (unsigned i = 0; i < num_pairs; i++) {
+      mset.push_arg(pairs[2 * i]);
+    }
+    requests.push_back(mset);
+  } else {
+    for (unsigned i = num_pairs; i > 0; i--) {
+      requests.push_back(Message(MessageType::SET, {table, pairs[2 * (i - 1)]}));
+    }
+  }
+  requests.push_back(Message(MessageType::BYE));
+  return requests;
+}
+
+}
 
 int main(int argc, char **argv)
 {
-  if (argc != 7) {
-    std::cerr << "Usage: ./set_value <hostname> <port> <username> <table> <key> <value>\n";
+  if (argc < 7 || (argc - 5) % 2 != 0) {
+    std::cerr << "Usage: ./set_value <hostname> <port> <username> <table> <key> <value> [<key> <value>...]\n";
     return 1;
   }
 
@@ -16,129 +46,41 @@ int main(int argc, char **argv)
   std::string port = argv[2];
   std::string username = argv[3];
   std::string table = argv[4];
-  std::string key = argv[5];
-  std::string value = argv[6];
-
-  // TODO: implement
-  int clientfd;
-  rio_t rio;
 
-  clientfd = open_clientfd(hostname.c_str(), port.c_str());
-  if (clientfd < 0) {
-    std::cerr << "Error: cannot establish connection to the server\n";
-    return 1;
-  }
-
-  rio_readinitb(&rio, clientfd);
-
-  // send the LOGIN message to the server
   try {
-    Message login_msg(MessageType::LOGIN, {username});
-    std::string encoded_message;
-    MessageSerialization::encode(login_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read response from the server 
-    char buf[Message::MAX_ENCODED_LEN];
-    ssize_t length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read response from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    Message response;
-    MessageSerialization::decode(std::string(buf, length), response);
-
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    // Send PUSH message with value
-    Message push_msg(MessageType::PUSH, {value});
-    MessageSerialization::encode(push_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // Read response
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read response from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    // send the message SET to server
-    Message set_msg(MessageType::SET, {table, key});
-    MessageSerialization::encode(set_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read response from server
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read response from server\n";
-      Close(clientfd);
-      return 1;
+    ClientUtil client;
+    client.connect(hostname, port);
+
+    // send every request at once (one round trip), then check the replies
+    unsigned num_pairs = (argc - 5) / 2;
+    bool use_mset = num_pairs > 1;
+    std::vector<Message> requests = set_requests(username, table, argv + 5, num_pairs, use_mset);
+    std::vector<Message> replies;
+    client.pipeline(requests, replies);
+
+    size_t mset_index = 1 + num_pairs;
+    if (use_mset && replies.size() > mset_index && replies[mset_index].get_message_type() == MessageType::ERROR) {
+      // a server without MSET drops the connection (having only pushed
+      // the values), so start over with a SET per key
+      client.close();
+      client.connect(hostname, port);
+      requests = set_requests(username, table, argv + 5, num_pairs, false);
+      client.pipeline(requests, replies);
     }
 
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() == MessageType::ERROR || response.get_message_type() == MessageType::FAILED) {
-      std::cerr << "Error: " << response.get_quoted_text() << "\n";
-      Close(clientfd);
-      return 1;
-    } else if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
+    if (!ClientUtil::check_replies(requests.size(), replies)) {
       return 1;
     }
-
-    // send the message BYE to server  
-    Message bye_msg(MessageType::BYE);
-    MessageSerialization::encode(bye_msg, encoded_message);
-    rio_writen(clientfd, encoded_message.c_str(), encoded_message.length());
-
-    // read the response from the server
-    length = rio_readlineb(&rio, buf, Message::MAX_ENCODED_LEN);
-    if (length <= 0) {
-      std::cerr << "Error: could not read response from server\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    MessageSerialization::decode(std::string(buf, length), response);
-    if (response.get_message_type() != MessageType::OK) {
-      std::cerr << "Error: bad server response\n";
-      Close(clientfd);
-      return 1;
-    }
-
-    Close(clientfd);
     return 0;
 
+  } catch (CommException &ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    return 1;
   } catch (InvalidMessage &ex) {
     std::cerr << "Error: " << ex.what() << "\n";
-    Close(clientfd);
     return 1;
   } catch (...) {
     std::cerr << "Error: unexpected error\n";
-    Close(clientfd);
     return 1;
   }
 }
-
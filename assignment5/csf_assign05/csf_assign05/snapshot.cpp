@@ -0,0 +1,154 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include "csapp.h"
+#include "binary_io.h"
+#include "table.h"
+#include "snapshot.h"
+
+namespace {
+
+const char MAGIC[] = "KVSNAP01";
+const size_t MAGIC_LEN = 8;
+const size_t FLUSH_SIZE = 1 << 20;
+
+// Buffers snapshot output, writing it out in large chunks
+// and keeping a running checksum
+class SnapshotWriter {
+private:
+  int m_fd;
+  std::string m_buf;
+  uint32_t m_sum;
+  bool m_ok;
+
+public:
+  SnapshotWriter( int fd ) : m_fd( fd ), m_sum( BinaryIO::CHECKSUM_SEED ), m_ok( true ) { }
+
+  std::string &buf() { return m_buf; }
+
+  void flush_if_full()
+  {
+    if (m_buf.size() >= FLUSH_SIZE) {
+      flush();
+    }
+  }
+
+  void flush()
+  {
+    m_sum = BinaryIO::checksum(m_buf.data(), m_buf.size(), m_sum);
+    if (m_ok && rio_writen(m_fd, m_buf.data(), m_buf.size()) != ssize_t(m_buf.size())) {
+      m_ok = false;
+    }
+    m_buf.clear();
+  }
+
+  bool finish()
+  {
+    flush();
+    std::string trailer;
+    BinaryIO::put_u32(trailer, m_sum);
+    return m_ok && rio_writen(m_fd, trailer.data(), trailer.size()) == ssize_t(trailer.size());
+  }
+};
+
+}
+
+bool Snapshot::write( const std::string &path, const std::vector<Table*> &tables, unsigned long lsn )
+{
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  SnapshotWriter out(fd);
+  out.buf().append(MAGIC, MAGIC_LEN);
+  BinaryIO::put_u64(out.buf(), lsn);
+  for (Table *table : tables) {
+    BinaryIO::put_u8(out.buf(), 1);
+    BinaryIO::put_string(out.buf(), table->get_name());
+    BinaryIO::put_u8(out.buf(), uint8_t(table->get_engine()));
+    table->for_each_committed([&out]( const std::string &key, const Value &value ) {
+      BinaryIO::put_u8(out.buf(), 1);
+      BinaryIO::put_string(out.buf(), key);
+      BinaryIO::put_string(out.buf(), value.to_string()); // same format as before: text
+      out.flush_if_full();
+    });
+    BinaryIO::put_u8(out.buf(), 0);
+  }
+  BinaryIO::put_u8(out.buf(), 0);
+
+  bool ok = out.finish() && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  // only replace the previous snapshot once the new one is complete
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Snapshot::load( const std::string &path, unsigned long &lsn,
+                     std::function<void( const std::string &, StorageEngine )> on_table,
+                     std::function<void( const std::string &, const std::string &, const std::string & )> on_entry )
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  std::string contents;
+  char buf[65536];
+  ssize_t n;
+  while ((n = rio_readn(fd, buf, sizeof(buf))) > 0) {
+    contents.append(buf, n);
+  }
+  Close(fd);
+
+  // check the magic number and the checksum before using anything
+  if (contents.size() < MAGIC_LEN + 8 + 1 + 4 || contents.compare(0, MAGIC_LEN, MAGIC) != 0) {
+    return false;
+  }
+  const char *end = contents.data() + contents.size() - 4;
+  const char *trailer = end;
+  uint32_t sum;
+  if (!BinaryIO::get_u32(trailer, contents.data() + contents.size(), sum)
+      || sum != BinaryIO::checksum(contents.data(), end - contents.data())) {
+    return false;
+  }
+
+  // parse twice: once to validate the structure, then again to deliver
+  // the contents, so a damaged file never half-loads
+  for (int pass = 0; pass < 2; pass++) {
+    const char *pos = contents.data() + MAGIC_LEN;
+    uint64_t snap_lsn;
+    uint8_t more;
+    if (!BinaryIO::get_u64(pos, end, snap_lsn) || !BinaryIO::get_u8(pos, end, more)) {
+      return false;
+    }
+    while (more) {
+      std::string name, key, value;
+      uint8_t engine;
+      if (!BinaryIO::get_string(pos, end, name) || !BinaryIO::get_u8(pos, end, engine)
+          || !BinaryIO::get_u8(pos, end, more)) {
+        return false;
+      }
+      if (pass == 1) {
+        on_table(name, StorageEngine(engine));
+      }
+      while (more) {
+        if (!BinaryIO::get_string(pos, end, key) || !BinaryIO::get_string(pos, end, value)
+            || !BinaryIO::get_u8(pos, end, more)) {
+          return false;
+        }
+        if (pass == 1) {
+          on_entry(name, key, value);
+        }
+      }
+      if (!BinaryIO::get_u8(pos, end, more)) {
+        return false;
+      }
+    }
+    lsn = snap_lsn;
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include "table_store.h"
+
+class Table; // forward declaration
+
+// Point-in-time snapshot files of every table's committed data.
+//
+// Format: "KVSNAP01", u64 LSN of the write-ahead log at the time of the
+// snapshot, then for each table: u8 1, name, u8 engine, and its entries
+// as (u8 1, key, value), ended by u8 0. The table list is ended by u8 0,
+// and the file ends with a u32 checksum of everything before it.
+namespace Snapshot {
+  // Write a snapshot of tables to path (via a temporary file that is
+  // renamed into place once it's on disk). The tables must not change
+  // while this runs. Returns false on failure.
+  bool write( const std::string &path, const std::vector<Table*> &tables, unsigned long lsn );
+
+  // Load the snapshot at path, calling on_table for each table and then
+  // on_entry for each of its entries. Returns false (without calling
+  // anything) if there is no snapshot or it's damaged; otherwise sets lsn.
+  bool load( const std::string &path, unsigned long &lsn,
+             std::function<void( const std::string &, StorageEngine )> on_table,
+             std::function<void( const std::string &, const std::string &, const std::string & )> on_entry );
+};
+
+#endif // SNAPSHOT_H
@@ -1,89 +1,399 @@
 #include <cassert>
+#include <algorithm>
+#include <functional>
+#include <ctime>
+#include <unistd.h>
 #include "table.h"
 #include "exceptions.h"
 #include "guard.h"
 
-Table::Table( const std::string &name )
+Table::Table( const std::string &name, StorageEngine engine )
   : m_name( name )
-  // TODO: initialize additional member variables
+  , m_engine( engine )
 {
-  // TODO: implement
-  pthread_mutex_init(&mutex, NULL);
+  for (unsigned i = 0; i < NUM_STRIPES; i++) {
+    pthread_mutex_init(&m_stripes[i].mutex, NULL);
+    pthread_rwlock_init(&m_stripes[i].latch, NULL);
+    m_stripes[i].version = 0;
+    m_stripes[i].owner = 0;
+    m_stripes[i].locked_at_us = 0;
+    m_stripes[i].profile.set_name("table:" + name + "/stripe" + std::to_string(i));
+    m_stripes[i].store = TableStore::create(engine);
+  }
 }
 
 Table::~Table()
 {
-  // TODO: implement
-  pthread_mutex_destroy(&mutex);
+  for (unsigned i = 0; i < NUM_STRIPES; i++) {
+    delete m_stripes[i].store;
+    pthread_rwlock_destroy(&m_stripes[i].latch);
+    pthread_mutex_destroy(&m_stripes[i].mutex);
+  }
+}
+
+unsigned Table::stripe_of( const std::string &key ) const
+{
+  return std::hash<std::string>()(key) % NUM_STRIPES;
 }
 
 void Table::lock()
 {
-  // TODO: implement
-  pthread_mutex_lock(&mutex);
+  // always in stripe order, so two whole-table lockers can't deadlock
+  for (unsigned i = 0; i < NUM_STRIPES; i++) {
+    lock_stripe(i);
+  }
 }
 
 void Table::unlock()
 {
-  // TODO: implement
-  pthread_mutex_unlock(&mutex);
+  for (unsigned i = NUM_STRIPES; i > 0; i--) {
+    unlock_stripe(i - 1);
+  }
 }
 
 bool Table::trylock()
 {
-  // TODO: implement
-  return pthread_mutex_trylock(&mutex) == 0;
+  for (unsigned i = 0; i < NUM_STRIPES; i++) {
+    if (!trylock_stripe(i)) {
+      // give back the stripes we already got
+      while (i > 0) {
+        unlock_stripe(--i);
+      }
+      return false;
+    }
+  }
+  return true;
 }
 
-void Table::set( const std::string &key, const std::string &value )
+namespace {
+
+uint64_t now_us()
 {
-  // TODO: implement
-  if(has_key(key)){
-    save_original[key] = table[key]; //save original key-value pair in separate map
-  } else {
-    added_keys.push_back(key); // remember keys that were added in separate vector
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return uint64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+struct timespec add_ms( struct timespec t, unsigned ms )
+{
+  t.tv_sec += ms / 1000;
+  t.tv_nsec += long(ms % 1000) * 1000000;
+  if (t.tv_nsec >= 1000000000) {
+    t.tv_sec++;
+    t.tv_nsec -= 1000000000;
   }
-  table[key] = value;
+  return t;
+}
+
+bool before( const struct timespec &a, const struct timespec &b )
+{
+  return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+}
+
+thread_local LockObserver *Table::t_lock_observer = nullptr;
+
+std::atomic<int> Table::s_num_parked(0);
+pthread_mutex_t Table::s_unlock_listeners_lock = PTHREAD_MUTEX_INITIALIZER;
+std::vector<int> Table::s_unlock_listeners;
 
+void Table::add_unlock_listener( int fd )
+{
+  pthread_mutex_lock(&s_unlock_listeners_lock);
+  s_unlock_listeners.push_back(fd);
+  pthread_mutex_unlock(&s_unlock_listeners_lock);
 }
 
-std::string Table::get( const std::string &key )
+void Table::notify_unlocked()
 {
-  // TODO: implement
-  return table[key];
+  uint64_t one = 1;
+  pthread_mutex_lock(&s_unlock_listeners_lock);
+  for (int fd : s_unlock_listeners) {
+    ssize_t n = write(fd, &one, sizeof(one)); // only fails if it's already been told plenty
+    (void) n;
+  }
+  pthread_mutex_unlock(&s_unlock_listeners_lock);
+}
+
+void Table::stripe_acquired( Stripe &s, uint64_t start_us )
+{
+  if (t_lock_observer == nullptr) {
+    s.locked_at_us = 0; // so unlocking doesn't report a bogus hold time
+    return;
+  }
+  s.locked_at_us = now_us();
+  t_lock_observer->stripe_locked(s.locked_at_us - start_us);
+}
+
+void Table::lock_stripe( unsigned stripe )
+{
+  Stripe &s = m_stripes[stripe];
+  uint64_t start = t_lock_observer != nullptr ? now_us() : 0;
+  LockProfiler::lock(s.mutex, s.profile);
+  stripe_acquired(s, start);
+}
+
+void Table::unlock_stripe( unsigned stripe )
+{
+  Stripe &s = m_stripes[stripe];
+  if (t_lock_observer != nullptr && s.locked_at_us != 0) {
+    t_lock_observer->stripe_unlocked(now_us() - s.locked_at_us);
+  }
+  s.owner = 0;
+  pthread_mutex_unlock(&s.mutex);
+  // a loop counts a request as parked before it tries the lock again,
+  // so the fence makes sure that either it sees the unlock or we see it
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (s_num_parked.load(std::memory_order_relaxed) > 0) {
+    notify_unlocked();
+  }
+}
+
+bool Table::trylock_stripe( unsigned stripe )
+{
+  Stripe &s = m_stripes[stripe];
+  if (!LockProfiler::trylock(s.mutex, s.profile)) {
+    if (t_lock_observer != nullptr) {
+      t_lock_observer->stripe_busy();
+    }
+    return false;
+  }
+  stripe_acquired(s, t_lock_observer != nullptr ? now_us() : 0);
+  return true;
+}
+
+bool Table::lock_stripe_wait_die( unsigned stripe, unsigned long ts, unsigned max_wait_ms, bool &waited )
+{
+  Stripe &s = m_stripes[stripe];
+  waited = false;
+  uint64_t start = t_lock_observer != nullptr ? now_us() : 0;
+  bool profiling = LockProfiler::is_enabled();
+  uint64_t wait_start_ns = 0;
+  struct timespec now, deadline;
+  clock_gettime(CLOCK_REALTIME, &now); // pthread_mutex_timedlock's clock
+  deadline = add_ms(now, max_wait_ms);
+
+  while (true) {
+    if (pthread_mutex_trylock(&s.mutex) == 0) {
+      break;
+    }
+    // die rather than wait for an older transaction, so waits only ever
+    // go from older to younger and can't form a cycle
+    unsigned long holder = s.owner;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if ((holder != 0 && holder < ts) || !before(now, deadline)) {
+      if (t_lock_observer != nullptr) {
+        t_lock_observer->stripe_busy();
+      }
+      if (profiling) {
+        s.profile.trylock_failed();
+      }
+      return false;
+    }
+    // wait in short slices, so we notice if an older transaction gets
+    // the stripe before we do
+    struct timespec slice = add_ms(now, 1);
+    if (before(deadline, slice)) {
+      slice = deadline;
+    }
+    if (profiling && !waited) {
+      wait_start_ns = LockProfiler::now_ns();
+    }
+    waited = true;
+    if (pthread_mutex_timedlock(&s.mutex, &slice) == 0) {
+      break;
+    }
+  }
+  if (profiling) {
+    if (waited) {
+      s.profile.acquired_after_wait(LockProfiler::now_ns() - wait_start_ns);
+    } else {
+      s.profile.acquired();
+    }
+  }
+  s.owner = ts;
+  stripe_acquired(s, start);
+  return true;
+}
+
+void Table::set( const std::string &key, const Value &value )
+{
+  Stripe &s = stripe_for(key);
+  pthread_rwlock_wrlock(&s.latch); // keep committed readers out while we change things
+  Value original;
+  if(s.store->get(key, original)){
+    // save original key-value pair in separate map (only the first time,
+    // so a second SET in the same transaction doesn't lose the original)
+    if(s.added_keys.find(key) == s.added_keys.end() && s.save_original.find(key) == s.save_original.end()){
+      s.save_original[key] = original;
+    }
+  } else {
+    s.added_keys.insert(key); // remember keys that were added in separate set
+  }
+  s.store->set(key, value);
+  pthread_rwlock_unlock(&s.latch);
+}
+
+// get() and has_key() don't need the latch: the caller holds the stripe
+// mutex, so nobody else can be changing the stripe
+
+Value Table::get( const std::string &key )
+{
+  Value value;
+  stripe_for(key).store->get(key, value);
+  return value;
 }
 
 bool Table::has_key( const std::string &key )
 {
-  // TODO: implement
-  return table.find(key) != table.end();
+  return stripe_for(key).store->has_key(key);
 }
 
-void Table::commit_changes()
+bool Table::get_committed( const std::string &key, Value &value, unsigned long *version )
 {
-  // TODO: implement
-  save_original.clear(); // do not need original values anymore
-  added_keys.clear(); // clear vector of added keys
+  Stripe &s = stripe_for(key);
+  pthread_rwlock_rdlock(&s.latch);
+  if (version != nullptr) {
+    *version = s.version;
+  }
+  bool found;
+  auto original = s.save_original.find(key);
+  if (original != s.save_original.end()) {
+    value = original->second; // changed by an open transaction
+    found = true;
+  } else if (s.added_keys.find(key) != s.added_keys.end()) {
+    found = false; // added by an open transaction, not committed yet
+  } else {
+    found = s.store->get(key, value);
+  }
+  pthread_rwlock_unlock(&s.latch);
+  return found;
+}
 
+void Table::scan_committed( const std::string &after, const std::string &prefix, size_t limit,
+                            std::vector<std::pair<std::string, Value>> &entries )
+{
+  // each stripe's keys are in order, so the answer is the first limit of
+  // the merged per-stripe answers. Once we have limit entries, a stripe
+  // can stop at the first key that wouldn't make the cut.
+  size_t start = entries.size();
+  std::vector<std::pair<std::string, Value>> found;
+  for (unsigned i = 0; i < NUM_STRIPES && limit > 0; i++) {
+    Stripe &s = m_stripes[i];
+    bool full = entries.size() - start == limit;
+    const std::string *bound = full ? &entries.back().first : nullptr;
+    found.clear();
+    pthread_rwlock_rdlock(&s.latch);
+    s.store->scan(after, prefix, limit, [&]( const std::string &key, const Value &value ) {
+      if (bound != nullptr && key >= *bound) {
+        return false;
+      }
+      if (s.added_keys.find(key) != s.added_keys.end()) {
+        return true; // added by an open transaction, not committed yet
+      }
+      auto original = s.save_original.find(key);
+      found.push_back(std::make_pair(key, original != s.save_original.end() ? original->second : value));
+      return found.size() < limit;
+    });
+    pthread_rwlock_unlock(&s.latch);
+
+    size_t middle = entries.size();
+    entries.insert(entries.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+    std::inplace_merge(entries.begin() + start, entries.begin() + middle, entries.end(),
+                       []( const std::pair<std::string, Value> &a, const std::pair<std::string, Value> &b ) {
+                         return a.first < b.first;
+                       });
+    if (entries.size() - start > limit) {
+      entries.resize(start + limit);
+    }
+  }
 }
 
-void Table::rollback_changes()
+void Table::freeze()
 {
-  // TODO: implement
-  std::map<std::string, std::string>::iterator itr = save_original.begin();
+  for (unsigned i = 0; i < NUM_STRIPES; i++) {
+    pthread_rwlock_rdlock(&m_stripes[i].latch);
+  }
+}
 
-  // for the map with original values
-  while(itr != save_original.end()){
-    std::string key = itr->first; // get key
-    table[key] = save_original[key]; // change table to original values
-    itr++;
+void Table::thaw()
+{
+  for (unsigned i = NUM_STRIPES; i > 0; i--) {
+    pthread_rwlock_unlock(&m_stripes[i - 1].latch);
+  }
+}
+
+void Table::for_each_committed( const TableStore::EntryFn &fn )
+{
+  for (unsigned i = 0; i < NUM_STRIPES; i++) {
+    Stripe &s = m_stripes[i];
+    s.store->for_each([&s, &fn]( const std::string &key, const Value &value ) {
+      if (s.added_keys.find(key) != s.added_keys.end()) {
+        return; // not committed yet
+      }
+      auto original = s.save_original.find(key);
+      fn(key, original != s.save_original.end() ? original->second : value);
+    });
+  }
+}
+
+void Table::get_pending_writes( unsigned stripe, std::vector<std::pair<std::string, Value>> &writes )
+{
+  Stripe &s = m_stripes[stripe];
+  Value value;
+  // changed keys are in save_original, new keys are in added_keys
+  for (auto &entry : s.save_original) {
+    s.store->get(entry.first, value);
+    writes.push_back(std::make_pair(entry.first, value));
+  }
+  for (const auto &key : s.added_keys) {
+    s.store->get(key, value);
+    writes.push_back(std::make_pair(key, value));
   }
+}
 
-  for (const auto& key : added_keys) {
-      table.erase(key); // erase all added_keys
+void Table::commit_stripe( unsigned stripe )
+{
+  Stripe &s = m_stripes[stripe];
+  // tentative values in the store become the committed ones
+  pthread_rwlock_wrlock(&s.latch);
+  if (!s.save_original.empty() || !s.added_keys.empty()) {
+    s.version++; // committed data changed
   }
-  added_keys.clear();
+  s.save_original.clear(); // do not need original values anymore
+  s.added_keys.clear(); // clear set of added keys
+  pthread_rwlock_unlock(&s.latch);
+}
 
+void Table::rollback_stripe( unsigned stripe )
+{
+  Stripe &s = m_stripes[stripe];
+  pthread_rwlock_wrlock(&s.latch);
 
+  // for the map with original values
+  for (auto &entry : s.save_original) {
+    s.store->set(entry.first, entry.second); // change table to original values
+  }
+  s.save_original.clear();
 
+  for (const auto& key : s.added_keys) {
+      s.store->erase(key); // erase all added_keys
+  }
+  s.added_keys.clear();
+  pthread_rwlock_unlock(&s.latch);
+}
+
+void Table::commit_changes()
+{
+  for (unsigned i = 0; i < NUM_STRIPES; i++) {
+    commit_stripe(i);
+  }
+}
+
+void Table::rollback_changes()
+{
+  for (unsigned i = 0; i < NUM_STRIPES; i++) {
+    rollback_stripe(i);
+  }
 }
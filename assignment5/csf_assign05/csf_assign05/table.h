@@ -3,36 +3,157 @@
 
 #include <map>
 #include <string>
+#include <set>
 #include <vector>
+#include <utility>
+#include <atomic>
+#include <cstdint>
 #include <pthread.h>
+#include "table_store.h"
+#include "lock_profiler.h"
+
+// Told how long the calling thread waited for and held stripe locks
+// (see Table::set_lock_observer), e.g. to keep metrics
+class LockObserver {
+public:
+  virtual ~LockObserver() { }
+  virtual void stripe_locked( uint64_t wait_us ) = 0;
+  virtual void stripe_unlocked( uint64_t hold_us ) = 0;
+  virtual void stripe_busy() = 0; // a trylock failed
+};
 
 class Table {
+public:
+  // number of lock stripes (keys are assigned to stripes by hash)
+  static const unsigned NUM_STRIPES = 32;
+
 private:
+  // A stripe owns the keys that hash to it, along with the lock that
+  // protects them and the undo information for uncommitted changes.
+  // Whoever holds a stripe's mutex owns its tentative changes, so
+  // save_original/added_keys never mix changes from different clients.
+  //
+  // The stripe keeps two versions of every key it holds: the tentative
+  // one (in store) and the last committed one (store, unless the key is
+  // in save_original or added_keys). Readers that only want committed
+  // data don't take the mutex at all, just the latch, which writers hold
+  // in write mode only while they're changing the data structures, never
+  // for the length of a transaction.
+  struct Stripe {
+    pthread_mutex_t mutex;
+    pthread_rwlock_t latch;
+    TableStore *store; // actual table (with tentative changes)
+    std::map<std::string, Value> save_original; // saves original when changed
+    std::set<std::string> added_keys; // marks which keys were added
+    unsigned long version; // bumped every time changes are committed
+    std::atomic<unsigned long> owner; // wait-die timestamp of the transaction holding mutex, 0 if none
+    uint64_t locked_at_us; // when mutex was locked, if the locking thread has a LockObserver
+    LockProfiler::Counters profile; // mutex contention, named "table:<name>/stripe<index>"
+  };
+
+  static thread_local LockObserver *t_lock_observer;
+
+  // see add_unlock_listener
+  static std::atomic<int> s_num_parked;
+  static pthread_mutex_t s_unlock_listeners_lock;
+  static std::vector<int> s_unlock_listeners;
+  static void notify_unlocked();
+
+  void stripe_acquired( Stripe &s, uint64_t start_us ); // tell the observer (if any)
+
   std::string m_name;
-  // TODO: add member variables
-  pthread_mutex_t mutex;
-  std::map<std::string, std::string> table; // actual table (with tentative changes)
-  std::map<std::string, std::string> save_original; // saves original when changed
-  std::vector<std::string> added_keys; // marks which keys were added
+  StorageEngine m_engine;
+  Stripe m_stripes[NUM_STRIPES];
   // copy constructor and assignment operator are prohibited
   Table( const Table & );
   Table &operator=( const Table & );
 
+  Stripe &stripe_for( const std::string &key ) { return m_stripes[stripe_of(key)]; }
+
 public:
-  Table( const std::string &name );
+  Table( const std::string &name, StorageEngine engine = StorageEngine::MAP );
   ~Table();
 
   std::string get_name() const { return m_name; }
+  StorageEngine get_engine() const { return m_engine; }
+
+  // which stripe a key belongs to
+  unsigned stripe_of( const std::string &key ) const;
 
+  // report the calling thread's stripe lock timings to observer
+  // (nullptr to stop); threads without an observer don't read the clock
+  static void set_lock_observer( LockObserver *observer ) { t_lock_observer = observer; }
+
+  // Event loops can't wait for a stripe, so they park the request and
+  // try it again later (see EventLoop). While any request is parked
+  // (parked_changed keeps count), unlocking a stripe adds 1 to every
+  // eventfd added here, so the loops know to try again.
+  static void add_unlock_listener( int fd );
+  static void parked_changed( int delta ) { s_num_parked += delta; }
+
+  // lock/unlock/trylock the whole table (every stripe, in order)
   void lock();
   void unlock();
   bool trylock();
 
+  // lock/unlock/trylock only the stripe with the given index
+  void lock_stripe( unsigned stripe );
+  void unlock_stripe( unsigned stripe );
+  bool trylock_stripe( unsigned stripe );
+
+  // Lock the stripe for the wait-die transaction with timestamp ts
+  // (smaller is older). If an older transaction holds it, give up right
+  // away; otherwise wait for it, but for at most max_wait_ms, since a
+  // holder that isn't a wait-die transaction (e.g. an autocommit MSET)
+  // may itself be waiting for us. Returns whether the stripe was locked,
+  // and sets waited if it had to wait.
+  bool lock_stripe_wait_die( unsigned stripe, unsigned long ts, unsigned max_wait_ms, bool &waited );
+  // wait-die timestamp of the transaction holding the stripe (0 if it's
+  // free or not held by one); may be out of date as soon as it's read
+  unsigned long stripe_owner( unsigned stripe ) const { return m_stripes[stripe].owner; }
+
   // Note: these functions should only be called while the
-  // table's lock is held!
-  void set( const std::string &key, const std::string &value );
+  // lock for the key's stripe (or the whole table) is held!
+  void set( const std::string &key, const Value &value );
   bool has_key( const std::string &key );
-  std::string get( const std::string &key );
+  Value get( const std::string &key );
+
+  // Read the last committed value of key, without the stripe lock
+  // (so this never waits for a transaction to finish). Returns false
+  // if key didn't exist as of the last commit.
+  // If version is non-null, it's set to the stripe's commit version,
+  // which changes whenever anything in the stripe is committed.
+  bool get_committed( const std::string &key, Value &value, unsigned long *version = nullptr );
+
+  // Append the first limit committed (key, value) pairs, in key order,
+  // whose keys come after `after` (every key, if after is empty) and
+  // start with prefix. Like get_committed, this never waits for a
+  // transaction; each stripe's latch is only held while that stripe is
+  // read, so the entries are each committed, but not necessarily as of
+  // the same moment.
+  void scan_committed( const std::string &after, const std::string &prefix, size_t limit,
+                       std::vector<std::pair<std::string, Value>> &entries );
+
+  // Hold/release every stripe's latch in read mode. While held, no
+  // stripe can change (committed or tentative), so the table can be
+  // read consistently without the stripe locks, e.g. for a snapshot.
+  void freeze();
+  void thaw();
+
+  // call fn with every committed (key, value); the table must be frozen
+  void for_each_committed( const TableStore::EntryFn &fn );
+
+  // append (key, tentative value) for every uncommitted change in
+  // the stripe (stripe must be locked)
+  void get_pending_writes( unsigned stripe, std::vector<std::pair<std::string, Value>> &writes );
+
+  // commit or roll back tentative changes in one stripe
+  // (stripe must be locked)
+  void commit_stripe( unsigned stripe );
+  void rollback_stripe( unsigned stripe );
+
+  // commit or roll back tentative changes in every stripe
+  // (whole table must be locked)
   void commit_changes();
   void rollback_changes();
 };
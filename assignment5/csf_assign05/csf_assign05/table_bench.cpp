@@ -0,0 +1,88 @@
+// Benchmark comparing the Table storage engines (map vs. hash)
+// on insert, lookup hit, and lookup miss workloads.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <ctime>
+#include "table.h"
+
+namespace {
+
+double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report( const std::string &engine, const std::string &what, unsigned long n, double secs )
+{
+  std::cout << engine << "\t" << what << "\t" << (secs * 1e9 / n) << " ns/op\n";
+}
+
+void bench_engine( StorageEngine engine, const std::vector<std::string> &keys,
+                   const std::vector<unsigned> &lookup_order )
+{
+  std::string name = TableStore::engine_name(engine);
+  Table table( "bench", engine );
+  table.lock();
+
+  double start = now_sec();
+  for (const std::string &key : keys) {
+    table.set(key, "12345");
+  }
+  table.commit_changes();
+  report(name, "insert", keys.size(), now_sec() - start);
+
+  unsigned long found = 0;
+  start = now_sec();
+  for (unsigned i : lookup_order) {
+    if (table.has_key(keys[i])) {
+      found += table.get(keys[i]).text_size();
+    }
+  }
+  report(name, "get_hit", lookup_order.size(), now_sec() - start);
+
+  start = now_sec();
+  for (unsigned i : lookup_order) {
+    found += table.has_key("missing" + keys[i]);
+  }
+  report(name, "get_miss", lookup_order.size(), now_sec() - start);
+
+  table.unlock();
+  if (found == 0) {
+    std::cerr << "Error: lookups found nothing\n";
+  }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  if ( argc > 2 ) {
+    std::cerr << "Usage: ./table_bench [<num keys>]\n";
+    return 1;
+  }
+  unsigned long num_keys = 1000000;
+  if ( argc == 2 ) {
+    num_keys = std::stoul(argv[1]);
+  }
+
+  std::vector<std::string> keys;
+  for (unsigned long i = 0; i < num_keys; i++) {
+    keys.push_back("acct" + std::to_string(i));
+  }
+  // look keys up in random order so neither engine benefits from locality
+  std::vector<unsigned> lookup_order(num_keys);
+  std::mt19937 rng(1234);
+  for (unsigned long i = 0; i < num_keys; i++) {
+    lookup_order[i] = rng() % num_keys;
+  }
+
+  std::cout << "engine\top\ttime (" << num_keys << " keys)\n";
+  bench_engine(StorageEngine::MAP, keys, lookup_order);
+  bench_engine(StorageEngine::HASH, keys, lookup_order);
+  return 0;
+}
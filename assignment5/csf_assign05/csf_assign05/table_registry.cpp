@@ -0,0 +1,59 @@
+#include <functional>
+#include "table.h"
+#include "table_registry.h"
+
+TableRegistry::TableRegistry()
+{
+  for (unsigned i = 0; i < NUM_SHARDS; i++) {
+    pthread_rwlock_init(&m_shards[i].lock, NULL);
+    m_shards[i].profile.set_name("registry:shard" + std::to_string(i));
+  }
+}
+
+TableRegistry::~TableRegistry()
+{
+  for (unsigned i = 0; i < NUM_SHARDS; i++) {
+    for (auto &entry : m_shards[i].tables) {
+      delete entry.second;
+    }
+    pthread_rwlock_destroy(&m_shards[i].lock);
+  }
+}
+
+TableRegistry::Shard &TableRegistry::shard_for( const std::string &name )
+{
+  return m_shards[std::hash<std::string>()(name) % NUM_SHARDS];
+}
+
+Table *TableRegistry::find( const std::string &name )
+{
+  Shard &shard = shard_for(name);
+  LockProfiler::rdlock(shard.lock, shard.profile); // shared: lookups don't exclude each other
+  Table *t = nullptr;
+  auto itr = shard.tables.find(name);
+  if (itr != shard.tables.end()) {
+    t = itr->second;
+  }
+  pthread_rwlock_unlock(&shard.lock);
+  return t;
+}
+
+bool TableRegistry::add( Table *table )
+{
+  Shard &shard = shard_for(table->get_name());
+  LockProfiler::wrlock(shard.lock, shard.profile); // exclusive, but only for this shard
+  bool added = shard.tables.insert(std::make_pair(table->get_name(), table)).second;
+  pthread_rwlock_unlock(&shard.lock);
+  return added;
+}
+
+void TableRegistry::get_all( std::vector<Table*> &tables )
+{
+  for (unsigned i = 0; i < NUM_SHARDS; i++) {
+    LockProfiler::rdlock(m_shards[i].lock, m_shards[i].profile);
+    for (auto &entry : m_shards[i].tables) {
+      tables.push_back(entry.second);
+    }
+    pthread_rwlock_unlock(&m_shards[i].lock);
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef TABLE_REGISTRY_H
+#define TABLE_REGISTRY_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "lock_profiler.h"
+
+class Table; // forward declaration
+
+// Concurrent map of table name -> Table, hash-partitioned into shards.
+// Each shard has its own reader-writer lock, so lookups (the common case)
+// run in parallel and creating a table only excludes lookups that hash
+// to the same shard.
+class TableRegistry {
+private:
+  struct Shard {
+    pthread_rwlock_t lock;
+    std::map<std::string, Table*> tables;
+    LockProfiler::Counters profile; // "registry:shard<index>"
+  };
+
+  static const unsigned NUM_SHARDS = 16;
+  Shard m_shards[NUM_SHARDS];
+
+  // copy constructor and assignment operator are prohibited
+  TableRegistry( const TableRegistry & );
+  TableRegistry &operator=( const TableRegistry & );
+
+  Shard &shard_for( const std::string &name );
+
+public:
+  TableRegistry();
+  ~TableRegistry(); // deletes all registered tables
+
+  // returns nullptr if there is no table with that name
+  Table *find( const std::string &name );
+
+  // takes ownership of table and returns true, or returns false
+  // (without taking ownership) if the name is already in use
+  bool add( Table *table );
+
+  // append every registered table to tables
+  void get_all( std::vector<Table*> &tables );
+};
+
+#endif // TABLE_REGISTRY_H
@@ -0,0 +1,120 @@
+#include <vector>
+#include <algorithm>
+#include "table_store.h"
+#include "hash_store.h"
+
+TableStore::~TableStore()
+{
+}
+
+TableStore *TableStore::create( StorageEngine engine )
+{
+  if (engine == StorageEngine::HASH) {
+    return new HashStore();
+  }
+  return new MapStore();
+}
+
+bool TableStore::parse_engine( const std::string &name, StorageEngine &engine )
+{
+  if (name == "map") {
+    engine = StorageEngine::MAP;
+  } else if (name == "hash") {
+    engine = StorageEngine::HASH;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void TableStore::scan( const std::string &after, const std::string &prefix, size_t limit,
+                       const ScanFn &fn ) const
+{
+  // the entries stay put while we're in here, so just point at them
+  typedef std::pair<const std::string*, const Value*> Entry;
+  std::vector<Entry> matches;
+  for_each([&]( const std::string &key, const Value &value ) {
+    if (key > after && key.compare(0, prefix.size(), prefix) == 0) {
+      matches.push_back(Entry(&key, &value));
+    }
+  });
+  auto less = []( const Entry &a, const Entry &b ) {
+    return *a.first < *b.first;
+  };
+  // a page is usually a small part of the matches, so only put the
+  // smallest ones in order, and only sort more if fn turns some down
+  auto done = matches.begin();
+  size_t chunk = std::max(limit, size_t(1));
+  while (done != matches.end()) {
+    auto chunk_end = size_t(matches.end() - done) > chunk ? done + chunk : matches.end();
+    std::partial_sort(done, chunk_end, matches.end(), less);
+    for (; done != chunk_end; ++done) {
+      if (!fn(*done->first, *done->second)) {
+        return;
+      }
+    }
+    chunk *= 2;
+  }
+}
+
+std::string TableStore::engine_name( StorageEngine engine )
+{
+  return engine == StorageEngine::HASH ? "hash" : "map";
+}
+
+MapStore::MapStore()
+{
+}
+
+MapStore::~MapStore()
+{
+}
+
+bool MapStore::get( const std::string &key, Value &value ) const
+{
+  auto itr = m_map.find(key);
+  if (itr == m_map.end()) {
+    return false;
+  }
+  value = itr->second;
+  return true;
+}
+
+void MapStore::set( const std::string &key, const Value &value )
+{
+  m_map[key] = value;
+}
+
+bool MapStore::has_key( const std::string &key ) const
+{
+  return m_map.find(key) != m_map.end();
+}
+
+void MapStore::erase( const std::string &key )
+{
+  m_map.erase(key);
+}
+
+size_t MapStore::size() const
+{
+  return m_map.size();
+}
+
+void MapStore::for_each( const EntryFn &fn ) const
+{
+  for (auto &entry : m_map) {
+    fn(entry.first, entry.second);
+  }
+}
+
+void MapStore::scan( const std::string &after, const std::string &prefix, size_t, const ScanFn &fn ) const
+{
+  // keys with the prefix are all together, starting at the first key
+  // that's >= prefix
+  auto itr = after < prefix ? m_map.lower_bound(prefix) : m_map.upper_bound(after);
+  for (; itr != m_map.end(); ++itr) {
+    if (itr->first.compare(0, prefix.size(), prefix) != 0 || !fn(itr->first, itr->second)) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef TABLE_STORE_H
+#define TABLE_STORE_H
+
+#include <map>
+#include <string>
+#include <functional>
+#include "value.h"
+
+// Storage engines that can back a Table (chosen at CREATE time)
+enum class StorageEngine {
+  MAP,  // ordered red-black tree (std::map)
+  HASH, // flat open-addressing hash table
+};
+
+// Interface implemented by each storage engine. A Table keeps one
+// store per lock stripe; stores do no locking of their own.
+class TableStore {
+public:
+  virtual ~TableStore();
+
+  // returns false (leaving value alone) if key isn't present
+  virtual bool get( const std::string &key, Value &value ) const = 0;
+  virtual void set( const std::string &key, const Value &value ) = 0;
+  virtual bool has_key( const std::string &key ) const = 0;
+  virtual void erase( const std::string &key ) = 0;
+  virtual size_t size() const = 0;
+
+  // call fn for every entry (in no particular order)
+  typedef std::function<void( const std::string &key, const Value &value )> EntryFn;
+  virtual void for_each( const EntryFn &fn ) const = 0;
+
+  // call fn, in key order, for the entries whose keys come after `after`
+  // (every key, if after is empty) and start with prefix, until fn
+  // returns false. fn is expected to want about limit entries: this
+  // default only sorts that many of the matches at a time (then twice
+  // as many, etc. if fn wants more); ordered engines override it to
+  // start at the right place.
+  typedef std::function<bool( const std::string &key, const Value &value )> ScanFn;
+  virtual void scan( const std::string &after, const std::string &prefix, size_t limit, const ScanFn &fn ) const;
+
+  // create an empty store for the given engine
+  static TableStore *create( StorageEngine engine );
+
+  // engine <-> name used in CREATE requests ("map" or "hash"),
+  // parse_engine returns false if the name is unknown
+  static bool parse_engine( const std::string &name, StorageEngine &engine );
+  static std::string engine_name( StorageEngine engine );
+};
+
+// Engine backed by std::map
+class MapStore : public TableStore {
+private:
+  std::map<std::string, Value> m_map;
+
+public:
+  MapStore();
+  virtual ~MapStore();
+
+  virtual bool get( const std::string &key, Value &value ) const;
+  virtual void set( const std::string &key, const Value &value );
+  virtual bool has_key( const std::string &key ) const;
+  virtual void erase( const std::string &key );
+  virtual size_t size() const;
+  virtual void for_each( const EntryFn &fn ) const;
+  virtual void scan( const std::string &after, const std::string &prefix, size_t limit, const ScanFn &fn ) const;
+};
+
+#endif // TABLE_STORE_H
@@ -3,6 +3,10 @@
 #include "message.h"
 #include "message_serialization.h"
 #include "table.h"
+#include "hash_store.h"
+#include "binary_io.h"
+#include "latency_histogram.h"
+#include "value.h"
 #include "value_stack.h"
 #include "exceptions.h"
 #include "tctest.h"
@@ -98,15 +102,27 @@ void test_message_is_valid( TestObjs *objs );
 void test_message_serialization_encode( TestObjs *objs );
 void test_message_serialization_encode_long( TestObjs *objs );
 void test_message_serialization_encode_too_long( TestObjs *objs );
+void test_message_serialization_encode_append( TestObjs *objs );
+void test_message_serialization_binary( TestObjs *objs );
 void test_message_serialization_decode( TestObjs *objs );
 void test_message_serialization_decode_invalid( TestObjs *objs );
+void test_message_serialization_decode_reuse( TestObjs *objs );
 void test_table_has_key( TestObjs *objs );
 void test_table_get( TestObjs *objs );
 void test_table_commit_changes( TestObjs *objs );
 void test_table_rollback_changes( TestObjs *objs );
 void test_table_commit_and_rollback( TestObjs *objs );
+void test_table_stripes( TestObjs *objs );
+void test_table_get_committed( TestObjs *objs );
+void test_hash_store( TestObjs *objs );
+void test_table_hash_engine( TestObjs *objs );
+void test_table_scan( TestObjs *objs );
 void test_value_stack( TestObjs *objs );
+void test_binary_io( TestObjs *objs );
+void test_latency_histogram( TestObjs *objs );
 void test_value_stack_exceptions( TestObjs *objs );
+void test_value_stack_mixed( TestObjs *objs );
+void test_value( TestObjs *objs );
 
 int main(int argc, char **argv)
 {
@@ -126,15 +142,27 @@ int main(int argc, char **argv)
   TEST( test_message_serialization_encode );
   TEST( test_message_serialization_encode_long );
   TEST( test_message_serialization_encode_too_long );
+  TEST( test_message_serialization_encode_append );
+  TEST( test_message_serialization_binary );
   TEST( test_message_serialization_decode );
   TEST( test_message_serialization_decode_invalid );
+  TEST( test_message_serialization_decode_reuse );
   TEST( test_table_has_key );
   TEST( test_table_get );
   TEST( test_table_commit_changes );
   TEST( test_table_rollback_changes );
   TEST( test_table_commit_and_rollback );
+  TEST( test_table_stripes );
+  TEST( test_table_get_committed );
+  TEST( test_hash_store );
+  TEST( test_table_hash_engine );
+  TEST( test_table_scan );
   TEST( test_value_stack );
   TEST( test_value_stack_exceptions );
+  TEST( test_value_stack_mixed );
+  TEST( test_value );
+  TEST( test_binary_io );
+  TEST( test_latency_histogram );
 
   TEST_FINI();
 }
@@ -295,6 +323,37 @@ void test_message_is_valid( TestObjs *objs )
   ASSERT( !objs->invalid_login_req.is_valid() );
   ASSERT( !objs->invalid_create_req.is_valid() );
   ASSERT( !objs->invalid_data_resp.is_valid() );
+
+  // MGET/MSET: a table and one or more keys, all identifiers
+  ASSERT( Message( MessageType::MGET, { "accounts", "a1", "a2" } ).is_valid() );
+  ASSERT( Message( MessageType::MSET, { "accounts", "a1" } ).is_valid() );
+  ASSERT( !Message( MessageType::MGET, { "accounts" } ).is_valid() );
+  ASSERT( !Message( MessageType::MSET, { "accounts", "a1", "2bad" } ).is_valid() );
+
+  // INCR and the fetch-and-ops name a table and a key
+  ASSERT( Message( MessageType::INCR, { "accounts", "a1" } ).is_valid() );
+  ASSERT( Message( MessageType::FMUL, { "accounts", "a1" } ).is_valid() );
+  ASSERT( !Message( MessageType::FADD, { "accounts" } ).is_valid() );
+
+  // stored procedures are named by an identifier
+  ASSERT( Message( MessageType::DEFPROC, { "transfer" } ).is_valid() );
+  ASSERT( Message( MessageType::ENDPROC ).is_valid() );
+  ASSERT( Message( MessageType::CALL, { "transfer" } ).is_valid() );
+  ASSERT( !Message( MessageType::CALL ).is_valid() );
+  ASSERT( !Message( MessageType::DEFPROC, { "2fer" } ).is_valid() );
+
+  // STATS may name a command
+  ASSERT( Message( MessageType::STATS ).is_valid() );
+  ASSERT( Message( MessageType::STATS, { "SET" } ).is_valid() );
+  ASSERT( !Message( MessageType::STATS, { "SET", "GET" } ).is_valid() );
+
+  // SCAN/PREFIX take a limit and maybe a key to resume after
+  ASSERT( Message( MessageType::SCAN, { "accounts", "100" } ).is_valid() );
+  ASSERT( Message( MessageType::SCAN, { "accounts", "100", "a1" } ).is_valid() );
+  ASSERT( Message( MessageType::PREFIX, { "accounts", "a", "10", "a1" } ).is_valid() );
+  ASSERT( !Message( MessageType::SCAN, { "accounts", "lots" } ).is_valid() );
+  ASSERT( !Message( MessageType::PREFIX, { "accounts", "a" } ).is_valid() );
+  ASSERT( Message( MessageType::ENTRY, { "a1", "42" } ).is_valid() );
 }
 
 void test_message_serialization_encode( TestObjs *objs )
@@ -339,6 +398,78 @@ void test_message_serialization_encode_too_long( TestObjs *objs )
   }
 }
 
+void test_message_serialization_encode_append( TestObjs *objs )
+{
+  // replies accumulate in one buffer
+  std::string out;
+  MessageSerialization::encode_append( objs->ok_resp, out );
+  MessageSerialization::encode_append( objs->data_resp, out );
+  std::string data;
+  MessageSerialization::encode( objs->data_resp, data );
+  ASSERT( "OK\n" + data == out );
+
+  // a message that's too long leaves the buffer alone
+  try {
+    MessageSerialization::encode_append( objs->invalid_too_long, out );
+    FAIL( "exception was not thrown for too-long encoded message" );
+  } catch (InvalidMessage &ex) {
+    // Good
+  }
+  ASSERT( "OK\n" + data == out );
+}
+
+void test_message_serialization_binary( TestObjs *objs )
+{
+  std::string frames;
+  MessageSerialization::encode_binary_append( objs->set_req, frames );
+  MessageSerialization::encode_binary_append( objs->failed_resp, frames );
+
+  // first frame: header, then the payload
+  uint32_t len;
+  ASSERT( MessageSerialization::binary_frame_len( frames, len ) );
+  std::string_view payload = std::string_view( frames ).substr( MessageSerialization::BINARY_HEADER_LEN, len );
+  Message msg;
+  MessageSerialization::decode_binary( payload, msg );
+  ASSERT( MessageType::SET == msg.get_message_type() );
+  ASSERT( 2 == msg.get_num_args() );
+  ASSERT( objs->set_req.get_table() == msg.get_table() );
+  ASSERT( objs->set_req.get_key() == msg.get_key() );
+
+  // second frame
+  size_t next = MessageSerialization::BINARY_HEADER_LEN + len;
+  ASSERT( MessageSerialization::binary_frame_len( std::string_view( frames ).substr( next ), len ) );
+  ASSERT( frames.size() == next + MessageSerialization::BINARY_HEADER_LEN + len );
+  MessageSerialization::decode_binary( std::string_view( frames ).substr( next + MessageSerialization::BINARY_HEADER_LEN ), msg );
+  ASSERT( MessageType::FAILED == msg.get_message_type() );
+  ASSERT( objs->failed_resp.get_quoted_text() == msg.get_quoted_text() );
+
+  // a partial header isn't a frame yet
+  ASSERT( !MessageSerialization::binary_frame_len( std::string_view( frames ).substr( 0, 3 ), len ) );
+
+  // values aren't limited to the length of a text line
+  std::string big( 5000, 'x' );
+  std::string frame;
+  MessageSerialization::encode_binary_append( Message( MessageType::PUSH, { big } ), frame );
+  MessageSerialization::decode_binary( std::string_view( frame ).substr( MessageSerialization::BINARY_HEADER_LEN ), msg );
+  ASSERT( MessageType::PUSH == msg.get_message_type() );
+  ASSERT( big == msg.get_value() );
+
+  // truncated payloads, trailing bytes, and unknown types are rejected
+  const std::string bad[] = {
+    frame.substr( MessageSerialization::BINARY_HEADER_LEN, 10 ),
+    frame.substr( MessageSerialization::BINARY_HEADER_LEN ) + "x",
+    std::string( "\xff\0", 2 ),
+  };
+  for (const std::string &payload : bad) {
+    try {
+      MessageSerialization::decode_binary( payload, msg );
+      FAIL( "exception was not thrown for bad binary message" );
+    } catch (InvalidMessage &ex) {
+      // Good
+    }
+  }
+}
+
 void test_message_serialization_decode( TestObjs *objs )
 {
   Message msg;
@@ -364,6 +495,16 @@ void test_message_serialization_decode( TestObjs *objs )
   ASSERT( "lineitems" == msg.get_table() );
   ASSERT( "foobar" == msg.get_key() );
 
+  MessageSerialization::decode( "FSUB lineitems foo\n", msg );
+  ASSERT( MessageType::FSUB == msg.get_message_type() );
+  ASSERT( "foo" == msg.get_key() );
+
+  MessageSerialization::decode( "MSET lineitems foo bar\n", msg );
+  ASSERT( MessageType::MSET == msg.get_message_type() );
+  ASSERT( 3 == msg.get_num_args() );
+  ASSERT( "lineitems" == msg.get_table() );
+  ASSERT( "bar" == msg.get_arg( 2 ) );
+
   MessageSerialization::decode( objs->encoded_failed_resp, msg );
   ASSERT( MessageType::FAILED == msg.get_message_type() );
   ASSERT( 1 == msg.get_num_args() );
@@ -398,6 +539,45 @@ void test_message_serialization_decode_invalid( TestObjs *objs )
   }
 }
 
+void test_message_serialization_decode_reuse( TestObjs * )
+{
+  // decoding into the same Message replaces everything from before
+  Message msg;
+  MessageSerialization::decode( "SET fruit apples\n", msg );
+  ASSERT( MessageType::SET == msg.get_message_type() );
+  ASSERT( 2 == msg.get_num_args() );
+  MessageSerialization::decode( "PUSH 42\n", msg );
+  ASSERT( MessageType::PUSH == msg.get_message_type() );
+  ASSERT( 1 == msg.get_num_args() );
+  ASSERT( "42" == msg.get_value() );
+  try {
+    msg.get_arg( 1 ); // left over from the SET, but not an argument now
+    FAIL( "No exception thrown for an argument past the end" );
+  } catch ( std::out_of_range &ex ) {
+    // Good
+  }
+  MessageSerialization::decode( "  TOP  \n", msg );
+  ASSERT( MessageType::TOP == msg.get_message_type() );
+  ASSERT( 0 == msg.get_num_args() );
+
+  // decoding works on part of a larger buffer
+  std::string buf = "GET t k\nBYE\n";
+  MessageSerialization::decode( std::string_view( buf ).substr( 0, 8 ), msg );
+  ASSERT( MessageType::GET == msg.get_message_type() );
+  ASSERT( "k" == msg.get_key() );
+
+  // copies only carry the current arguments
+  Message copy( msg );
+  ASSERT( 2 == copy.get_num_args() );
+  ASSERT( "t" == copy.get_table() );
+
+  // every command name maps back to its type, anything else is NONE
+  ASSERT( MessageType::COMMIT == MessageSerialization::lookup_command( "COMMIT" ) );
+  ASSERT( MessageType::SUB == MessageSerialization::lookup_command( "SUB" ) );
+  ASSERT( MessageType::NONE == MessageSerialization::lookup_command( "SUX" ) );
+  ASSERT( MessageType::NONE == MessageSerialization::lookup_command( "get" ) );
+}
+
 void test_table_has_key( TestObjs *objs )
 {
   {
@@ -569,6 +749,218 @@ void test_table_commit_and_rollback( TestObjs *objs )
   }
 }
 
+// Test that keys in different stripes can be locked, committed,
+// and rolled back independently of each other.
+void test_table_stripes( TestObjs *objs )
+{
+  Table *t = objs->invoices;
+
+  // find two keys that live in different stripes
+  std::string key1 = "key0";
+  std::string key2;
+  for (int i = 1; key2.empty(); i++) {
+    std::string candidate = "key" + std::to_string(i);
+    if (t->stripe_of(candidate) != t->stripe_of(key1)) {
+      key2 = candidate;
+    }
+  }
+  unsigned s1 = t->stripe_of(key1);
+  unsigned s2 = t->stripe_of(key2);
+
+  // locking one stripe doesn't prevent locking another
+  ASSERT( t->trylock_stripe(s1) );
+  ASSERT( !t->trylock_stripe(s1) );
+  ASSERT( t->trylock_stripe(s2) );
+
+  // ...but does prevent locking the whole table
+  ASSERT( !t->trylock() );
+
+  t->set( key1, "100" );
+  t->set( key2, "200" );
+
+  // commit one stripe, roll back the other
+  t->commit_stripe( s1 );
+  t->rollback_stripe( s2 );
+  t->unlock_stripe( s2 );
+  t->unlock_stripe( s1 );
+
+  {
+    TableGuard g( t );
+
+    ASSERT( "100" == t->get( key1 ) );
+    ASSERT( !t->has_key( key2 ) );
+
+    // overwrite twice, then roll back: original value comes back
+    t->set( key1, "101" );
+    t->set( key1, "102" );
+    t->rollback_changes();
+    ASSERT( "100" == t->get( key1 ) );
+  }
+}
+
+// Readers of committed data see the value as of the last commit,
+// without taking the table lock, while a change is pending.
+void test_table_get_committed( TestObjs *objs )
+{
+  Table *t = objs->invoices;
+  Value value;
+
+  {
+    TableGuard g( t );
+    t->set( "abc123", "1000" );
+    t->commit_changes();
+  }
+
+  t->lock(); // pretend a transaction has the table locked
+  t->set( "abc123", "2000" );
+  t->set( "abc123", "3000" );
+  t->set( "xyz456", "1318" );
+
+  // committed readers don't need the lock and don't see pending changes
+  ASSERT( t->get_committed( "abc123", value ) );
+  ASSERT( "1000" == value );
+  ASSERT( !t->get_committed( "xyz456", value ) );
+
+  // a key added and then changed in the same transaction is still pending
+  t->set( "xyz456", "1319" );
+  ASSERT( !t->get_committed( "xyz456", value ) );
+
+  t->commit_changes();
+  t->unlock();
+
+  ASSERT( t->get_committed( "abc123", value ) );
+  ASSERT( "3000" == value );
+  ASSERT( t->get_committed( "xyz456", value ) );
+  ASSERT( "1319" == value );
+}
+
+void test_hash_store( TestObjs * )
+{
+  HashStore store;
+  Value value;
+
+  ASSERT( 0 == store.size() );
+  ASSERT( !store.get( "nope", value ) );
+
+  // enough keys to force the table to grow several times
+  for (int i = 0; i < 1000; i++) {
+    store.set( "k" + std::to_string(i), std::to_string(i * 2) );
+  }
+  ASSERT( 1000 == store.size() );
+  ASSERT( store.capacity() > 1000 );
+
+  // overwriting doesn't add an entry
+  store.set( "k7", "seven" );
+  ASSERT( 1000 == store.size() );
+  ASSERT( store.get( "k7", value ) );
+  ASSERT( "seven" == value );
+
+  // erase every other key; the rest must still be reachable
+  for (int i = 0; i < 1000; i += 2) {
+    store.erase( "k" + std::to_string(i) );
+  }
+  ASSERT( 500 == store.size() );
+  for (int i = 0; i < 1000; i++) {
+    std::string key = "k" + std::to_string(i);
+    if (i % 2 == 0) {
+      ASSERT( !store.has_key( key ) );
+    } else if (i != 7) {
+      ASSERT( store.get( key, value ) );
+      ASSERT( std::to_string(i * 2) == value );
+    }
+  }
+
+  // erasing a missing key is harmless
+  store.erase( "k0" );
+  ASSERT( 500 == store.size() );
+}
+
+void test_table_hash_engine( TestObjs * )
+{
+  Table t( "hashed", StorageEngine::HASH );
+  ASSERT( StorageEngine::HASH == t.get_engine() );
+
+  TableGuard g( &t );
+
+  t.set( "apples", "100" );
+  t.set( "bananas", "150" );
+  t.commit_changes();
+
+  t.set( "apples", "1" );
+  t.set( "oranges", "220" );
+  ASSERT( "1" == t.get( "apples" ) );
+  ASSERT( t.has_key( "oranges" ) );
+
+  // rollback works the same as with the map engine
+  t.rollback_changes();
+  ASSERT( "100" == t.get( "apples" ) );
+  ASSERT( "150" == t.get( "bananas" ) );
+  ASSERT( !t.has_key( "oranges" ) );
+}
+
+void test_table_scan( TestObjs * )
+{
+  StorageEngine engines[] = { StorageEngine::MAP, StorageEngine::HASH };
+  for (StorageEngine engine : engines) {
+    Table t( "scanned", engine );
+    {
+      TableGuard g( &t );
+      for (int i = 0; i < 100; i++) {
+        t.set( "k" + std::to_string(100 + i), std::to_string(i) ); // k100..k199
+      }
+      t.set( "other", "x" );
+      t.commit_changes();
+    }
+
+    // in key order, resuming after the last key
+    std::vector<std::pair<std::string, Value>> entries;
+    t.scan_committed( "", "", 3, entries );
+    ASSERT( 3 == entries.size() );
+    ASSERT( "k100" == entries[0].first && "0" == entries[0].second );
+    ASSERT( "k102" == entries[2].first );
+    std::string cursor = entries.back().first;
+    t.scan_committed( cursor, "", 2, entries );
+    ASSERT( 5 == entries.size() );
+    ASSERT( "k103" == entries[3].first && "k104" == entries[4].first );
+
+    // a prefix, and the end of the table
+    entries.clear();
+    t.scan_committed( "", "k15", 100, entries );
+    ASSERT( 10 == entries.size() );
+    ASSERT( "k150" == entries[0].first && "k159" == entries[9].first );
+    entries.clear();
+    t.scan_committed( "k198", "", 100, entries );
+    ASSERT( 2 == entries.size() );
+    ASSERT( "k199" == entries[0].first && "other" == entries[1].first );
+
+    // only committed data: an open transaction's changes aren't seen
+    TableGuard g( &t );
+    t.set( "k100", "changed" );
+    t.set( "k0", "added" );
+    entries.clear();
+    t.scan_committed( "", "", 1, entries );
+    ASSERT( 1 == entries.size() );
+    ASSERT( "k100" == entries[0].first && "0" == entries[0].second );
+    t.rollback_changes();
+  }
+
+  // a store still scans in order when fn wants more than limit entries
+  TableStore *store = TableStore::create( StorageEngine::HASH );
+  for (int i = 0; i < 50; i++) {
+    store->set( "k" + std::to_string(100 + i), std::to_string(i) );
+  }
+  std::vector<std::string> keys;
+  store->scan( "k104", "", 2, [&]( const std::string &key, const Value & ) {
+    keys.push_back( key );
+    return keys.size() < 7;
+  });
+  ASSERT( 7 == keys.size() );
+  for (int i = 0; i < 7; i++) {
+    ASSERT( "k" + std::to_string(105 + i) == keys[i] );
+  }
+  delete store;
+}
+
 void test_value_stack( TestObjs *objs )
 {
   // stack should be empty initially
@@ -614,3 +1006,203 @@ void test_value_stack_exceptions( TestObjs *objs )
     // good
   }
 }
+
+void test_value_stack_mixed( TestObjs *objs )
+{
+  char buf[Value::MAX_INT_TEXT];
+  int64_t n;
+
+  // integers and text interleaved, so text has to come back from
+  // the right place in the shared buffer after pops
+  objs->valstack.push_text( "abc" );
+  objs->valstack.push_int( -5 );
+  objs->valstack.push_text( "007" );
+  objs->valstack.push_text( "42" );
+  objs->valstack.push( Value( "xyz" ) );
+  ASSERT( 5 == objs->valstack.size() );
+
+  ASSERT( "xyz" == objs->valstack.get_top_text( buf ) );
+  ASSERT( !objs->valstack.get_top_int( n ) );
+  objs->valstack.pop();
+  ASSERT( objs->valstack.get_top().is_int() );
+  ASSERT( "42" == objs->valstack.get_top_text( buf ) );
+  objs->valstack.pop();
+  ASSERT( !objs->valstack.get_top().is_int() );
+  ASSERT( objs->valstack.get_top_int( n ) && 7 == n );
+  ASSERT( "007" == objs->valstack.get_top_text( buf ) );
+  objs->valstack.pop();
+  ASSERT( objs->valstack.get_top_int( n ) && -5 == n );
+  objs->valstack.pop();
+
+  // text pushed after a pop goes where the popped text was
+  objs->valstack.push_text( "d" );
+  ASSERT( "d" == objs->valstack.get_top_text( buf ) );
+  objs->valstack.pop();
+  ASSERT( "abc" == objs->valstack.get_top() );
+
+  objs->valstack.clear();
+  ASSERT( objs->valstack.is_empty() );
+  try {
+    objs->valstack.get_top_text( buf );
+    FAIL( "ValueStack didn't throw exception for get_top_text() on empty stack" );
+  } catch ( OperationException &ex ) {
+    // good
+  }
+}
+
+void test_value( TestObjs * )
+{
+  // integers written the usual way are kept as integers...
+  ASSERT( Value( "42" ).is_int() );
+  ASSERT( Value( "-7" ).is_int() && -7 == Value( "-7" ).get_int() );
+  ASSERT( Value( "0" ).is_int() );
+  ASSERT( Value( "-9223372036854775808" ).is_int() );
+  ASSERT( "-9223372036854775808" == Value( "-9223372036854775808" ).to_string() );
+
+  // ...anything else stays text, exactly as given
+  ASSERT( !Value( "007" ).is_int() && "007" == Value( "007" ).to_string() );
+  ASSERT( !Value( "-0" ).is_int() );
+  ASSERT( !Value( "+1" ).is_int() );
+  ASSERT( !Value( "9223372036854775808" ).is_int() );
+  ASSERT( !Value( "abc" ).is_int() );
+  ASSERT( !Value( "" ).is_int() );
+
+  // text of digits still works as an operand
+  int64_t n;
+  ASSERT( Value( "007" ).to_int( n ) && 7 == n );
+  ASSERT( !Value( "abc" ).to_int( n ) );
+  ASSERT( !Value( "-" ).to_int( n ) );
+  ASSERT( !Value( "99999999999999999999" ).to_int( n ) );
+
+  ASSERT( Value( "12" ) == Value::from_int( 12 ) );
+  ASSERT( Value( "12" ) != Value( "012" ) );
+  ASSERT( 3 == Value::from_int( -123 ).text_size() - 1 );
+
+  // 64-bit arithmetic, checked for overflow
+  ASSERT( -2 == Value::arithmetic( '-', 3, 5 ) );
+  ASSERT( 5000000000LL == Value::arithmetic( '*', 50000, 100000 ) );
+  ASSERT( 3 == Value::arithmetic( '/', 7, 2 ) );
+  try {
+    Value::arithmetic( '+', INT64_MAX, 1 );
+    FAIL( "no exception for overflow" );
+  } catch ( OperationException &ex ) {
+    // good
+  }
+  try {
+    Value::arithmetic( '/', INT64_MIN, -1 );
+    FAIL( "no exception for overflow" );
+  } catch ( OperationException &ex ) {
+    // good
+  }
+  try {
+    Value::arithmetic( '/', 1, 0 );
+    FAIL( "no exception for division by zero" );
+  } catch ( OperationException &ex ) {
+    // good
+  }
+}
+
+void test_binary_io( TestObjs * )
+{
+  std::string buf;
+  BinaryIO::put_u8( buf, 7 );
+  BinaryIO::put_u32( buf, 0xdeadbeef );
+  BinaryIO::put_u64( buf, 1ULL << 40 );
+  BinaryIO::put_string( buf, "hello" );
+  ASSERT( 1 + 4 + 8 + 4 + 5 == buf.size() );
+
+  const char *pos = buf.data();
+  const char *end = pos + buf.size();
+  uint8_t u8;
+  uint32_t u32;
+  uint64_t u64;
+  std::string str;
+  ASSERT( BinaryIO::get_u8( pos, end, u8 ) );
+  ASSERT( 7 == u8 );
+  ASSERT( BinaryIO::get_u32( pos, end, u32 ) );
+  ASSERT( 0xdeadbeef == u32 );
+  ASSERT( BinaryIO::get_u64( pos, end, u64 ) );
+  ASSERT( (1ULL << 40) == u64 );
+  ASSERT( BinaryIO::get_string( pos, end, str ) );
+  ASSERT( "hello" == str );
+  ASSERT( pos == end );
+
+  // reading past the end fails without moving
+  ASSERT( !BinaryIO::get_u8( pos, end, u8 ) );
+  pos = buf.data() + buf.size() - 6; // string with one byte missing
+  ASSERT( !BinaryIO::get_string( pos, end - 1, str ) );
+  ASSERT( pos == buf.data() + buf.size() - 6 );
+
+  // checksum notices a changed byte
+  uint32_t sum = BinaryIO::checksum( buf.data(), buf.size() );
+  buf[3] ^= 1;
+  ASSERT( sum != BinaryIO::checksum( buf.data(), buf.size() ) );
+}
+
+void test_latency_histogram( TestObjs * )
+{
+  LatencyHistogram hist;
+  ASSERT( 0 == hist.count() );
+  ASSERT( 0 == hist.percentile( 50 ) );
+
+  // small values are exact
+  for ( uint64_t v = 1; v <= 100; v++ ) {
+    hist.record( v );
+  }
+  ASSERT( 100 == hist.count() );
+  ASSERT( 1 == hist.min() );
+  ASSERT( 100 == hist.max() );
+  ASSERT( 50 == hist.percentile( 50 ) );
+  ASSERT( 99 == hist.percentile( 99 ) );
+  ASSERT( 100 == hist.percentile( 100 ) );
+
+  // buckets are contiguous and never off by more than 1/128
+  for ( uint64_t v = 0; v < 100000; v += 7 ) {
+    unsigned b = hist.bucket_of( v );
+    ASSERT( v <= hist.bucket_high( b ) );
+    ASSERT( hist.bucket_high( b ) - v <= v / 128 );
+    ASSERT( b == 0 || v > hist.bucket_high( b - 1 ) );
+  }
+  ASSERT( hist.bucket_high( hist.bucket_of( UINT64_MAX ) ) == UINT64_MAX );
+
+  // coarser histograms are off by at most 1/2^sub_bits
+  LatencyHistogram coarse( 4 );
+  for ( uint64_t v = 0; v < 100000; v += 7 ) {
+    unsigned b = coarse.bucket_of( v );
+    ASSERT( v <= coarse.bucket_high( b ) );
+    ASSERT( coarse.bucket_high( b ) - v <= v / 16 );
+    ASSERT( b == 0 || v > coarse.bucket_high( b - 1 ) );
+  }
+  ASSERT( coarse.bucket_high( coarse.bucket_of( UINT64_MAX ) ) == UINT64_MAX );
+
+  // merging adds the counts
+  LatencyHistogram other;
+  for ( int i = 0; i < 900; i++ ) {
+    other.record( 1000000 );
+  }
+  hist.merge( other );
+  ASSERT( 1000 == hist.count() );
+  ASSERT( 1000000 == hist.max() );
+  uint64_t p50 = hist.percentile( 50 );
+  ASSERT( p50 >= 1000000 && p50 <= 1000000 + 1000000 / 128 );
+  ASSERT( 100 == hist.percentile( 10 ) );
+
+  hist.clear();
+  ASSERT( 0 == hist.count() );
+  ASSERT( 0 == hist.max() );
+
+  // an atomic histogram adds up to the same as a plain one
+  AtomicLatencyHistogram shared( 4 );
+  for ( uint64_t v = 5; v <= 5000; v += 5 ) {
+    shared.record( v );
+    coarse.record( v );
+  }
+  LatencyHistogram summed( 4 );
+  shared.add_to( summed );
+  shared.add_to( summed );
+  ASSERT( 2000 == summed.count() );
+  ASSERT( 5 == summed.min() && 5000 == summed.max() );
+  ASSERT( coarse.percentile( 50 ) == summed.percentile( 50 ) );
+  ASSERT( coarse.percentile( 99 ) == summed.percentile( 99 ) );
+  ASSERT( coarse.mean() == summed.mean() );
+}
@@ -0,0 +1,135 @@
+#include <climits>
+#include <charconv>
+#include "exceptions.h"
+#include "value.h"
+
+namespace {
+
+// whether text is how n would be written: no leading zeros (or '+'),
+// no "-0"
+bool is_canonical( std::string_view text )
+{
+  size_t i = (!text.empty() && text[0] == '-') ? 1 : 0;
+  if (i == text.size()) {
+    return false;
+  }
+  return text[i] != '0' || (i == 0 && text.size() == 1);
+}
+
+}
+
+bool Value::text_to_int( std::string_view text, int64_t &n )
+{
+  size_t i = (!text.empty() && text[0] == '-') ? 1 : 0;
+  if (i == text.size()) {
+    return false;
+  }
+  uint64_t magnitude = 0;
+  uint64_t max = i == 1 ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX);
+  for (; i < text.size(); i++) {
+    if (text[i] < '0' || text[i] > '9') {
+      return false;
+    }
+    unsigned digit = text[i] - '0';
+    if (magnitude > (max - digit) / 10) {
+      return false;
+    }
+    magnitude = magnitude * 10 + digit;
+  }
+  n = text[0] == '-' ? int64_t(0 - magnitude) : int64_t(magnitude);
+  return true;
+}
+
+bool Value::parse( std::string_view text, int64_t &n )
+{
+  return is_canonical(text) && text_to_int(text, n);
+}
+
+std::string_view Value::int_text( int64_t n, char *buf )
+{
+  char *end = std::to_chars(buf, buf + MAX_INT_TEXT, n).ptr;
+  return std::string_view(buf, end - buf);
+}
+
+Value::Value()
+  : m_is_int( false )
+  , m_int( 0 )
+{
+}
+
+Value::Value( std::string_view text )
+  : m_is_int( false )
+  , m_int( 0 )
+{
+  if (parse(text, m_int)) {
+    m_is_int = true;
+  } else {
+    m_int = 0;
+    m_text.assign(text.data(), text.size());
+  }
+}
+
+Value Value::from_int( int64_t n )
+{
+  Value v;
+  v.m_is_int = true;
+  v.m_int = n;
+  return v;
+}
+
+bool Value::to_int( int64_t &n ) const
+{
+  if (m_is_int) {
+    n = m_int;
+    return true;
+  }
+  return text_to_int(m_text, n);
+}
+
+std::string_view Value::text( char *buf ) const
+{
+  return m_is_int ? int_text(m_int, buf) : std::string_view(m_text);
+}
+
+std::string Value::to_string() const
+{
+  char buf[MAX_INT_TEXT];
+  return std::string(text(buf));
+}
+
+size_t Value::text_size() const
+{
+  char buf[MAX_INT_TEXT];
+  return text(buf).size();
+}
+
+bool operator==( const Value &a, const Value &b )
+{
+  if (a.m_is_int != b.m_is_int) {
+    return false;
+  }
+  return a.m_is_int ? a.m_int == b.m_int : a.m_text == b.m_text;
+}
+
+int64_t Value::arithmetic( char op, int64_t left, int64_t right )
+{
+  int64_t result;
+  bool overflow;
+  if (op == '+') {
+    overflow = __builtin_add_overflow(left, right, &result);
+  } else if (op == '-') {
+    overflow = __builtin_sub_overflow(left, right, &result);
+  } else if (op == '*') {
+    overflow = __builtin_mul_overflow(left, right, &result);
+  } else {
+    if (right == 0) { // cannot divide by 0
+      throw OperationException("\"Cannot divide by zero.\"");
+    }
+    overflow = left == INT64_MIN && right == -1;
+    result = overflow ? 0 : left / right;
+  }
+  if (overflow) {
+    throw OperationException("\"Integer overflow\"");
+  }
+  return result;
+}
@@ -0,0 +1,61 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// A value in a table or on a client's stack: a 64-bit integer or text.
+// Text that is an integer written the usual way ("0", "42", "-7", but not
+// "007" or "+7") is always kept as the integer, so counters are added to
+// without being parsed and formatted every time, and turning the value
+// back into text (only done to send or log it) gives the original text.
+class Value {
+public:
+  // room for the text of any integer ("-9223372036854775808")
+  static const size_t MAX_INT_TEXT = 20;
+
+private:
+  bool m_is_int;
+  int64_t m_int;
+  std::string m_text; // when !m_is_int
+
+public:
+  Value(); // empty text
+  Value( std::string_view text );
+  Value( const std::string &text ) : Value( std::string_view( text ) ) { }
+  Value( const char *text ) : Value( std::string_view( text ) ) { }
+
+  static Value from_int( int64_t n );
+
+  bool is_int() const { return m_is_int; }
+  int64_t get_int() const { return m_int; } // only if is_int()
+
+  // the value as an integer, if it is one or is text of only digits
+  // (optionally after a '-') that fits, e.g. "007"; false otherwise
+  bool to_int( int64_t &n ) const;
+
+  // the value as text; an integer is written into buf (at least
+  // MAX_INT_TEXT chars), so this never allocates
+  std::string_view text( char *buf ) const;
+  std::string to_string() const;
+  size_t text_size() const; // to_string().size(), without making it
+
+  // same kind and contents (text compares equal to the value it parses to)
+  friend bool operator==( const Value &a, const Value &b );
+  friend bool operator!=( const Value &a, const Value &b ) { return !(a == b); }
+
+  // the helpers behind the above, for code that keeps values its own way
+  // (e.g. ValueStack): whether text is an integer n written the usual way
+  // (what makes Value(text) an integer), to_int() for text, and text(buf)
+  // for an integer
+  static bool parse( std::string_view text, int64_t &n );
+  static bool text_to_int( std::string_view text, int64_t &n );
+  static std::string_view int_text( int64_t n, char *buf );
+
+  // the result of left op right ('+', '-', '*' or '/'); throws
+  // OperationException on overflow or division by zero
+  static int64_t arithmetic( char op, int64_t left, int64_t right );
+};
+
+#endif // VALUE_H
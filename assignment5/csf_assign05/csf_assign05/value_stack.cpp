@@ -2,8 +2,9 @@
 #include "exceptions.h"
 
 ValueStack::ValueStack()
-  // TODO: initialize member variable(s) (if necessary)
 {
+  m_entries.reserve(INITIAL_ENTRIES);
+  m_bytes.reserve(INITIAL_BYTES);
 }
 
 ValueStack::~ValueStack()
@@ -12,30 +13,103 @@ ValueStack::~ValueStack()
 
 bool ValueStack::is_empty() const
 {
-  return stack.empty();
+  return m_entries.empty();
 }
 
-void ValueStack::push( const std::string &value )
+size_t ValueStack::size() const
 {
-  stack.push_back(value); // push to top of stack (end of vector)
+  return m_entries.size();
 }
 
-std::string ValueStack::get_top() const
+const ValueStack::Entry &ValueStack::top() const
 {
   // throw exception if empty
-  if(stack.empty()){
+  if(m_entries.empty()){
     throw OperationException("Stack is empty.");
   }
 
-  return stack.back(); // top of stack = back of vector
+  return m_entries.back(); // top of stack = back of vector
+}
+
+void ValueStack::push_bytes( std::string_view text )
+{
+  Entry e;
+  e.n = 0;
+  e.offset = m_bytes.size();
+  e.len = text.size();
+  e.is_int = false;
+  m_bytes.append(text.data(), text.size());
+  m_entries.push_back(e);
+}
+
+void ValueStack::push( const Value &value )
+{
+  if (value.is_int()) {
+    push_int(value.get_int());
+  } else {
+    push_bytes(value.text(nullptr)); // buf is only used for integers
+  }
+}
+
+void ValueStack::push_text( std::string_view text )
+{
+  int64_t n;
+  if (Value::parse(text, n)) {
+    push_int(n);
+  } else {
+    push_bytes(text);
+  }
+}
+
+void ValueStack::push_int( int64_t n )
+{
+  Entry e;
+  e.n = n;
+  e.offset = 0;
+  e.len = 0;
+  e.is_int = true;
+  m_entries.push_back(e);
+}
+
+Value ValueStack::get_top() const
+{
+  const Entry &e = top();
+  if (e.is_int) {
+    return Value::from_int(e.n);
+  }
+  return Value(std::string_view(m_bytes.data() + e.offset, e.len));
+}
+
+bool ValueStack::get_top_int( int64_t &n ) const
+{
+  const Entry &e = top();
+  if (e.is_int) {
+    n = e.n;
+    return true;
+  }
+  return Value::text_to_int(std::string_view(m_bytes.data() + e.offset, e.len), n);
+}
+
+std::string_view ValueStack::get_top_text( char *buf ) const
+{
+  const Entry &e = top();
+  if (e.is_int) {
+    return Value::int_text(e.n, buf);
+  }
+  return std::string_view(m_bytes.data() + e.offset, e.len);
 }
 
 void ValueStack::pop()
 {
-  // throw exception if empty
-  if(stack.empty()){
-    throw OperationException("Stack is empty.");
+  const Entry &e = top();
+  if (!e.is_int) {
+    m_bytes.resize(e.offset); // it's the last text in the buffer
   }
+  m_entries.pop_back(); // pop off top of stack (end of vector)
+}
 
-  stack.pop_back(); // pop off top of stack (end of vector)
+void ValueStack::clear()
+{
+  m_entries.clear();
+  m_bytes.clear();
 }
@@ -3,24 +3,54 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include "value.h"
 
+// A client's stack of values. Rather than a Value (and maybe a heap
+// string) per entry, the text of all text entries is kept end to end in
+// one buffer, and each entry is a small record holding its integer or
+// where its text is. Only the top is ever popped, so popping just
+// shrinks the buffer; neither buffer gives memory back, so once a
+// connection's stack has been as deep as it gets, push/pop don't allocate.
 class ValueStack {
+public:
+  // reserved up front, enough for typical request sequences
+  static const size_t INITIAL_ENTRIES = 16;
+  static const size_t INITIAL_BYTES = 512;
+
 private:
-  // TODO: member variable(s)
-  std::vector<std::string> stack; // represents stack (back of vector = top)
+  struct Entry {
+    int64_t n;            // if is_int
+    uint32_t offset, len; // text in m_bytes, if !is_int
+    bool is_int;
+  };
+
+  std::vector<Entry> m_entries; // back of vector = top
+  std::string m_bytes;          // text of the text entries, bottom to top
+
+  const Entry &top() const;
+  void push_bytes( std::string_view text );
 
 public:
   ValueStack();
   ~ValueStack();
 
   bool is_empty() const;
-  void push( const std::string &value );
+  size_t size() const;
+  void push( const Value &value );
+  void push_text( std::string_view text ); // push(Value(text)) without the Value
+  void push_int( int64_t n );
 
-  // Note: get_top() and pop() should throw OperationException
+  // Note: the get_top functions and pop() throw OperationException
   // if called when the stack is empty
 
-  std::string get_top() const;
+  Value get_top() const;
+  bool get_top_int( int64_t &n ) const; // get_top().to_int(n)
+  // get_top().text(buf), valid until the next push/pop
+  std::string_view get_top_text( char *buf ) const;
   void pop();
+  void clear(); // keeps the memory for reuse
 };
 
 #endif // VALUE_STACK_H
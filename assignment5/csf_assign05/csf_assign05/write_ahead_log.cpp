@@ -0,0 +1,250 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "csapp.h"
+#include "exceptions.h"
+#include "guard.h"
+#include "binary_io.h"
+#include "write_ahead_log.h"
+
+WriteAheadLog::WriteAheadLog()
+  : m_fd( -1 )
+  , m_mutex_profile( "wal" )
+  , m_end_lsn( 0 )
+  , m_durable_lsn( 0 )
+  , m_failed( false )
+  , m_num_records( 0 )
+  , m_num_flushes( 0 )
+{
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_work, NULL);
+  pthread_cond_init(&m_durable, NULL);
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+  // the flusher thread runs for the life of the server, so the log is
+  // never destroyed while it's open
+  pthread_cond_destroy(&m_durable);
+  pthread_cond_destroy(&m_work);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+void WriteAheadLog::open( const std::string &path, unsigned long start_lsn )
+{
+  m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+  if (m_fd < 0) {
+    throw CommException("Could not open write-ahead log: " + std::string(strerror(errno)));
+  }
+  // drop a torn tail left by a crash, then append after the intact records
+  if (ftruncate(m_fd, start_lsn) < 0 || lseek(m_fd, start_lsn, SEEK_SET) < 0) {
+    throw CommException("Could not prepare write-ahead log: " + std::string(strerror(errno)));
+  }
+  m_end_lsn = m_durable_lsn = start_lsn;
+
+  pthread_t thr_id;
+  if (pthread_create(&thr_id, nullptr, flush_worker, this) != 0) {
+    throw CommException("Could not create write-ahead log thread");
+  }
+  pthread_detach(thr_id);
+}
+
+unsigned long WriteAheadLog::append( const std::string &payload )
+{
+  std::string header;
+  BinaryIO::put_u32(header, payload.size());
+  BinaryIO::put_u32(header, BinaryIO::checksum(payload.data(), payload.size()));
+
+  Guard g(m_mutex, m_mutex_profile);
+  if (m_failed) {
+    // the log can't be trusted past the failed write, so don't add to it;
+    // this LSN will never be durable, so the commit isn't acknowledged
+    return m_end_lsn + 1;
+  }
+  m_buffer += header;
+  m_buffer += payload;
+  m_end_lsn += header.size() + payload.size();
+  m_num_records++;
+  pthread_cond_signal(&m_work);
+  return m_end_lsn;
+}
+
+unsigned long WriteAheadLog::log_create( const std::string &name, StorageEngine engine )
+{
+  std::string payload;
+  BinaryIO::put_u8(payload, RECORD_CREATE);
+  BinaryIO::put_string(payload, name);
+  BinaryIO::put_u8(payload, uint8_t(engine));
+  return append(payload);
+}
+
+unsigned long WriteAheadLog::log_commit( const std::vector<WalWrite> &writes )
+{
+  std::string payload;
+  BinaryIO::put_u8(payload, RECORD_COMMIT);
+  BinaryIO::put_u32(payload, writes.size());
+  for (const WalWrite &write : writes) {
+    BinaryIO::put_string(payload, write.table);
+    BinaryIO::put_string(payload, write.key);
+    BinaryIO::put_string(payload, write.value);
+  }
+  return append(payload);
+}
+
+void WriteAheadLog::wait_durable( unsigned long lsn )
+{
+  Guard g(m_mutex, m_mutex_profile);
+  while (m_durable_lsn < lsn && !m_failed) {
+    pthread_cond_wait(&m_durable, &m_mutex);
+  }
+  if (m_durable_lsn < lsn) {
+    throw CommException("write-ahead log failed");
+  }
+}
+
+bool WriteAheadLog::is_durable( unsigned long lsn )
+{
+  Guard g(m_mutex, m_mutex_profile);
+  if (m_durable_lsn < lsn && m_failed) {
+    throw CommException("write-ahead log failed");
+  }
+  return m_durable_lsn >= lsn;
+}
+
+void WriteAheadLog::add_durable_listener( int fd )
+{
+  Guard g(m_mutex, m_mutex_profile);
+  m_listeners.push_back(fd);
+}
+
+unsigned long WriteAheadLog::end_lsn()
+{
+  Guard g(m_mutex, m_mutex_profile);
+  return m_end_lsn;
+}
+
+bool WriteAheadLog::discard_before( unsigned long lsn )
+{
+  // records before lsn may not all be written yet; it doesn't matter
+  // whether they land before or after the hole, the snapshot has them
+  return lsn == 0 || fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, lsn) == 0;
+}
+
+void WriteAheadLog::get_stats( unsigned long &num_records, unsigned long &num_flushes )
+{
+  Guard g(m_mutex, m_mutex_profile);
+  num_records = m_num_records;
+  num_flushes = m_num_flushes;
+}
+
+void *WriteAheadLog::flush_worker( void *arg )
+{
+  WriteAheadLog *log = static_cast<WriteAheadLog *>( arg );
+  log->flush_loop();
+  return nullptr;
+}
+
+void WriteAheadLog::flush_loop()
+{
+  std::string batch;
+  while (true) {
+    unsigned long batch_end;
+    {
+      Guard g(m_mutex, m_mutex_profile);
+      while (m_buffer.empty()) {
+        pthread_cond_wait(&m_work, &m_mutex);
+      }
+      // take everything appended so far; appends that arrive while we're
+      // writing go into the next batch
+      batch.swap(m_buffer);
+      m_buffer.clear();
+      batch_end = m_end_lsn;
+    }
+
+    bool ok = rio_writen(m_fd, batch.data(), batch.size()) == ssize_t(batch.size())
+              && fdatasync(m_fd) == 0;
+
+    Guard g(m_mutex, m_mutex_profile);
+    if (ok) {
+      m_durable_lsn = batch_end;
+      m_num_flushes++;
+    } else {
+      // can't tell what made it to disk (and after a short write, offsets
+      // in the file aren't LSNs any more), so never write or acknowledge
+      // anything again: later batches would be acknowledged, then lost
+      // when replay stops at the torn record
+      m_failed = true;
+      m_buffer.clear();
+    }
+    pthread_cond_broadcast(&m_durable);
+    uint64_t one = 1;
+    for (int fd : m_listeners) {
+      ssize_t n = write(fd, &one, sizeof(one)); // only fails if it's already been told plenty
+      (void) n;
+    }
+  }
+}
+
+unsigned long WriteAheadLog::replay( const std::string &path, unsigned long start_lsn,
+                                     std::function<void( const std::string &, StorageEngine )> on_create,
+                                     std::function<void( const std::vector<WalWrite> & )> on_commit )
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return 0; // no log yet
+  }
+  std::string contents;
+  char buf[65536];
+  ssize_t n;
+  if (lseek(fd, start_lsn, SEEK_SET) >= 0) {
+    while ((n = rio_readn(fd, buf, sizeof(buf))) > 0) {
+      contents.append(buf, n);
+    }
+  }
+  Close(fd);
+
+  const char *pos = contents.data();
+  const char *end = pos + contents.size();
+  const char *intact_end = pos;
+  while (true) {
+    uint32_t len, sum;
+    const char *p = pos;
+    if (!BinaryIO::get_u32(p, end, len) || !BinaryIO::get_u32(p, end, sum)
+        || uint32_t(end - p) < len || BinaryIO::checksum(p, len) != sum) {
+      break; // end of log, or a record that was only partly written
+    }
+    const char *rec_end = p + len;
+    uint8_t type;
+    bool ok = BinaryIO::get_u8(p, rec_end, type);
+    if (ok && type == RECORD_CREATE) {
+      std::string name;
+      uint8_t engine;
+      ok = BinaryIO::get_string(p, rec_end, name) && BinaryIO::get_u8(p, rec_end, engine);
+      if (ok) {
+        on_create(name, StorageEngine(engine));
+      }
+    } else if (ok && type == RECORD_COMMIT) {
+      uint32_t count;
+      std::vector<WalWrite> writes;
+      ok = BinaryIO::get_u32(p, rec_end, count);
+      for (uint32_t i = 0; ok && i < count; i++) {
+        WalWrite write;
+        ok = BinaryIO::get_string(p, rec_end, write.table)
+             && BinaryIO::get_string(p, rec_end, write.key)
+             && BinaryIO::get_string(p, rec_end, write.value);
+        writes.push_back(write);
+      }
+      if (ok) {
+        on_commit(writes);
+      }
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      break; // checksum matched but the record makes no sense; stop here
+    }
+    pos = intact_end = rec_end;
+  }
+  return start_lsn + (intact_end - contents.data());
+}
@@ -0,0 +1,101 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <pthread.h>
+#include "lock_profiler.h"
+#include "table_store.h"
+
+// One committed key/value change
+struct WalWrite {
+  std::string table;
+  std::string key;
+  std::string value;
+};
+
+// Append-only redo log of committed changes, with group commit.
+//
+// Appending a record only copies it into an in-memory buffer and
+// returns its LSN (the log offset just past the record). A background
+// flusher thread writes out everything buffered so far and fsyncs it
+// once, so commits that arrive while an fsync is in progress all share
+// the next one. Callers wait_durable(lsn) before acknowledging a commit,
+// or (if they mustn't block) check is_durable(lsn) whenever a listener
+// fd says another fsync has finished.
+//
+// Record format: u32 payload length, u32 checksum of payload, payload.
+// Payload is a type byte followed by the record's fields; strings are
+// a u32 length followed by the bytes.
+class WriteAheadLog {
+private:
+  int m_fd;
+  pthread_mutex_t m_mutex;
+  LockProfiler::Counters m_mutex_profile;
+  pthread_cond_t m_work; // signalled when there is something to flush
+  pthread_cond_t m_durable; // signalled after each fsync
+  std::string m_buffer; // records appended but not written yet
+  unsigned long m_end_lsn; // offset just past the last appended record
+  unsigned long m_durable_lsn; // everything before this offset is on disk
+  bool m_failed; // a write or fsync failed, nothing more is written or made durable
+  std::vector<int> m_listeners; // eventfds written after each fsync
+  unsigned long m_num_records;
+  unsigned long m_num_flushes;
+
+  // copy constructor and assignment operator are prohibited
+  WriteAheadLog( const WriteAheadLog & );
+  WriteAheadLog &operator=( const WriteAheadLog & );
+
+  unsigned long append( const std::string &payload );
+  static void *flush_worker( void *arg );
+  void flush_loop();
+
+public:
+  enum RecordType {
+    RECORD_CREATE = 1, // table name, storage engine
+    RECORD_COMMIT = 2, // count, then (table, key, value) for each write
+  };
+
+  WriteAheadLog();
+  ~WriteAheadLog();
+
+  // open (creating if necessary) the log for appending at offset
+  // start_lsn (anything past it is a torn tail and is discarded),
+  // and start the flusher thread; throws CommException on failure
+  void open( const std::string &path, unsigned long start_lsn );
+
+  // append records, returning the LSN to wait for (once the log has
+  // failed nothing is appended, and waiting for the LSN throws)
+  unsigned long log_create( const std::string &name, StorageEngine engine );
+  unsigned long log_commit( const std::vector<WalWrite> &writes );
+
+  // block until every record up to lsn is durable;
+  // throws CommException if the log can't be written
+  void wait_durable( unsigned long lsn );
+  // whether every record up to lsn is durable, without waiting;
+  // throws CommException if it never will be
+  bool is_durable( unsigned long lsn );
+  // have the flusher add 1 to the eventfd after every fsync (or failure)
+  void add_durable_listener( int fd );
+
+  // LSN just past the last appended record
+  unsigned long end_lsn();
+
+  // Free the disk space taken by everything before lsn (once a snapshot
+  // covers it). The file isn't shortened, since LSNs are offsets in it;
+  // the start just becomes a hole. Returns false if that failed.
+  bool discard_before( unsigned long lsn );
+
+  void get_stats( unsigned long &num_records, unsigned long &num_flushes );
+
+  // Read the log at path from offset start_lsn, calling on_create and
+  // on_commit for every intact record, in order. Stops at the end of
+  // the file or at the first torn/corrupt record. Returns the offset
+  // just past the last intact record (0 if there is no log).
+  static unsigned long replay( const std::string &path, unsigned long start_lsn,
+                               std::function<void( const std::string &, StorageEngine )> on_create,
+                               std::function<void( const std::vector<WalWrite> & )> on_commit );
+};
+
+#endif // WRITE_AHEAD_LOG_H